@@ -23,6 +23,19 @@ public:
 		Vec3f offset = u * rd.x + v * rd.y;
 		return Ray(origin+offset, lower_left_corner + s * horizonal + t * vertical - origin-offset);
 	}
+	// the s,t that get_ray takes for a ray through p from the middle of the lens, and how far p is in front
+	// of the camera. false for points behind it
+	bool project(const Point3f& p, double& s, double& t, double& depth) const {
+		Vec3f d = p - origin;
+		depth = -d.dotProduct(w);
+		if (depth <= 0) return false;
+		//the focus plane is where lower_left_corner is, as far along -w as its centre
+		Vec3f centre = lower_left_corner + horizonal / 2 + vertical / 2 - origin;
+		Vec3f on_plane = origin + d * static_cast<float>(centre.length() / depth) - lower_left_corner;
+		s = on_plane.dotProduct(horizonal) / horizonal.norm();
+		t = on_plane.dotProduct(vertical) / vertical.norm();
+		return true;
+	}
 private:
 	Point3f origin;
 	Point3f horizonal;
@@ -1,16 +1,32 @@
 #pragma once
 #include "geometry.h"
-#include "SDL.h" 
 #include <fstream>
 #include <chrono>
 
+// the reciprocal direction and its signs are worked out once here, every box test along the ray reuses them
 class Ray {
 public:
     Ray() {};
-    Ray(const Point3f& origin, const Vec3f& direction) : o(origin), d(direction) {}
+    Ray(const Point3f& origin, const Vec3f& direction) : o(origin), d(direction) {
+        inv_d = Vec3f(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+        sign[0] = inv_d.x < 0;
+        sign[1] = inv_d.y < 0;
+        sign[2] = inv_d.z < 0;
+    }
+    // for callers that already have the reciprocal, like ray_stream
+    Ray(const Point3f& origin, const Vec3f& direction, const Vec3f& inverse) : o(origin), d(direction), inv_d(inverse) {
+        sign[0] = inv_d.x < 0;
+        sign[1] = inv_d.y < 0;
+        sign[2] = inv_d.z < 0;
+    }
 
-    Point3f origin() const { return o; }
-    Vec3f direction() const { return d; }
+    const Point3f& origin() const { return o; }
+    const Vec3f& direction() const { return d; }
+    const Vec3f& inv_direction() const { return inv_d; }
+    Vec3f unit_direction() const {
+        Vec3f u = d;
+        return u.normalize();
+    }
 
     Point3f at(double t) const {
         return o + t * d;
@@ -18,4 +34,6 @@ public:
 public:
     Point3f o;
     Vec3f d;
+    Vec3f inv_d;
+    int sign[3]; // 1 where the direction is negative, picks which slab plane is entered first
 };
\ No newline at end of file
@@ -49,6 +49,7 @@ public:
 	virtual Colour colour_Value(double u, double v, const Vec3f& p) const override {
 		//if no texture is loaded cyan is used to debug
 		if (data == nullptr) { return Colour(0, 1, 1); }
+		counters().texture_lookups++;
 
 		//clamp text coords
 		u = clamp(u, 0.0, 1.0);
@@ -1,5 +1,12 @@
 #pragma once
 #include "common.h"
+#include "counters.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AABB_SSE
+#include <xmmintrin.h>
+#endif
 
 class aabb {
 public:
@@ -9,28 +16,75 @@ public:
 	Point3f min() const { return minimum; }
 	Point3f max() const { return maximum; }
 
+	double surface_area() const {
+		Vec3f d = maximum - minimum;
+		return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// slab test using the ray's cached reciprocal direction, in float and without branches.
+	// an axis where the origin sits on a slab plane of a parallel ray gives 0 * inf = NaN, the
+	// comparisons are ordered so a NaN falls back to t_min or t_max and the axis is skipped
 	bool hit(const Ray& r, double t_min, double t_max) const {
+		counters().box_tests++;
+#ifdef AABB_SSE
+		const Point3f& o = r.origin();
+		const Vec3f& inv = r.inv_direction();
+		//the fourth lane repeats x so it can not change the result
+		__m128 origin = _mm_set_ps(o.x, o.z, o.y, o.x);
+		__m128 inv_d = _mm_set_ps(inv.x, inv.z, inv.y, inv.x);
+		__m128 lo = _mm_set_ps(minimum.x, minimum.z, minimum.y, minimum.x);
+		__m128 hi = _mm_set_ps(maximum.x, maximum.z, maximum.y, maximum.x);
+		//near and far planes picked by direction like the scalar path, -0 going down. sorting the two
+		//distances with minps instead would let a NaN on either plane turn into an infinity
+		__m128 down = _mm_cmplt_ps(inv_d, _mm_setzero_ps());
+		__m128 near_plane = _mm_or_ps(_mm_and_ps(down, hi), _mm_andnot_ps(down, lo));
+		__m128 far_plane = _mm_or_ps(_mm_and_ps(down, lo), _mm_andnot_ps(down, hi));
+		__m128 t_near = _mm_mul_ps(_mm_sub_ps(near_plane, origin), inv_d);
+		__m128 t_far = _mm_mul_ps(_mm_sub_ps(far_plane, origin), inv_d);
+		//maxps and minps return the second operand when either is NaN, so that is t_min or t_max
+		__m128 t0 = _mm_max_ps(t_near, _mm_set1_ps(static_cast<float>(t_min)));
+		__m128 t1 = _mm_min_ps(t_far, _mm_set1_ps(static_cast<float>(t_max)));
+		t0 = _mm_max_ps(t0, _mm_shuffle_ps(t0, t0, _MM_SHUFFLE(1, 0, 3, 2)));
+		t0 = _mm_max_ps(t0, _mm_shuffle_ps(t0, t0, _MM_SHUFFLE(2, 3, 0, 1)));
+		t1 = _mm_min_ps(t1, _mm_shuffle_ps(t1, t1, _MM_SHUFFLE(1, 0, 3, 2)));
+		t1 = _mm_min_ps(t1, _mm_shuffle_ps(t1, t1, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_comilt_ss(t0, t1) != 0;
+#else
+		float t0 = static_cast<float>(t_min), t1 = static_cast<float>(t_max);
 		for (int a = 0; a < 3; a++) {
-			auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a], (maximum[a] - r.origin()[a]) / r.direction()[a]);
-			auto t1 = fmax((minimum[a] - r.origin()[a]) / r.direction()[a], (maximum[a] - r.origin()[a]) / r.direction()[a]);
-			t_min = fmax(t0, t_min);
-			t_max = fmin(t1, t_max);
-			if (t_max <= t_min) { return false; }
+			float near_t = ((r.sign[a] ? maximum[a] : minimum[a]) - r.origin()[a]) * r.inv_direction()[a];
+			float far_t = ((r.sign[a] ? minimum[a] : maximum[a]) - r.origin()[a]) * r.inv_direction()[a];
+			t0 = near_t > t0 ? near_t : t0;
+			t1 = far_t < t1 ? far_t : t1;
 		}
-		return true;
+		return t0 < t1;
+#endif
 	}
 	Point3f minimum;
 	Point3f maximum;
 };
 
+// exact, padding every merge made boxes grow with depth. primitives pad their own box once with padded()
 aabb surrounding_box(aabb box0, aabb box1) {
-	Point3f small(fmin(box0.min().x - 1e-3, box1.min().x - 1e-3),
-		fmin(box0.min().y - 1e-3, box1.min().y - 1e-3),
-		fmin(box0.min().z - 1e-3, box1.min().z - 1e-3));
+	Point3f small(fmin(box0.min().x, box1.min().x),
+		fmin(box0.min().y, box1.min().y),
+		fmin(box0.min().z, box1.min().z));
 
-	Point3f big(fmax(box0.max().x + 1e-3, box1.max().x + 1e-3),
-		fmax(box0.max().y + 1e-3, box1.max().y + 1e-3),
-		fmax(box0.max().z + 1e-3, box1.max().z + 1e-3));
+	Point3f big(fmax(box0.max().x, box1.max().x),
+		fmax(box0.max().y, box1.max().y),
+		fmax(box0.max().z, box1.max().z));
 
 	return aabb(small, big);
+}
+
+// grows a primitive's box a little, scaled to how far it is from the origin. gives axis aligned
+// triangles a thickness the slab test can hit and covers the rounding of the test itself
+inline aabb padded(const aabb& b) {
+	Point3f small = b.min(), big = b.max();
+	for (int a = 0; a < 3; a++) {
+		float pad = 1e-5f * (1.0f + std::max(std::fabs(small[a]), std::fabs(big[a])));
+		small[a] -= pad;
+		big[a] += pad;
+	}
+	return aabb(small, big);
 }
\ No newline at end of file
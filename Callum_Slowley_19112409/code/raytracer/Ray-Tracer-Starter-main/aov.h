@@ -0,0 +1,96 @@
+#pragma once
+#include "common.h"
+#include "counters.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// per pixel cost of the last frame, written as false colour images next to the render.
+// the counts come from the calling thread's render_counters, read before and after each pixel,
+// so they only work with renderers that finish a pixel on one thread before starting the next
+struct aov_buffers {
+	int width = 0, height = 0;
+	std::vector<float> node_visits;    // per sample
+	std::vector<float> triangle_tests; // per sample
+	std::vector<float> path_depth;     // average rays per sample, 1 for a camera ray that stops
+	std::vector<float> time_us;        // whole pixel
+
+	void resize(int w, int h);
+	// writes <prefix>_nodes.tga, _triangles.tga, _depth.tga and _time.tga
+	void write(const std::string& prefix) const;
+};
+
+// brackets the work for one pixel and stores what it cost
+class aov_pixel {
+public:
+	aov_pixel(aov_buffers* buffers, int px, int py) : aov(buffers), x(px), y(py) {
+		if (!aov) return;
+		start = counters();
+		t_start = std::chrono::high_resolution_clock::now();
+	}
+	void finish(int spp) {
+		if (!aov) return;
+		double us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t_start).count();
+		const render_counters& now = counters();
+		size_t i = size_t(y) * aov->width + x;
+		aov->node_visits[i] = float(now.node_visits - start.node_visits) / spp;
+		aov->triangle_tests[i] = float(now.triangle_tests - start.triangle_tests) / spp;
+		aov->path_depth[i] = float(now.primary_rays + now.secondary_rays - start.primary_rays - start.secondary_rays) / spp;
+		aov->time_us[i] = static_cast<float>(us);
+	}
+
+private:
+	aov_buffers* aov;
+	int x, y;
+	render_counters start;
+	std::chrono::high_resolution_clock::time_point t_start;
+};
+
+void aov_buffers::resize(int w, int h) {
+	width = w;
+	height = h;
+	for (auto* v : { &node_visits, &triangle_tests, &path_depth, &time_us }) v->assign(size_t(w) * h, 0.0f);
+}
+
+// blue through cyan, green and yellow to red, black for nothing at all
+inline TGAColor false_colour(float t) {
+	static const float stops[5][3] = { { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+	if (t <= 0) return TGAColor(0, 0, 0, 255);
+	t = std::min(t, 1.0f) * 4;
+	int i = std::min(3, static_cast<int>(t));
+	float f = t - i;
+	float c[3];
+	for (int k = 0; k < 3; k++) c[k] = stops[i][k] + (stops[i + 1][k] - stops[i][k]) * f;
+	return TGAColor(static_cast<unsigned char>(c[0]), static_cast<unsigned char>(c[1]), static_cast<unsigned char>(c[2]), 255);
+}
+
+inline void write_heatmap(const std::vector<float>& values, int width, int height, const std::string& filename) {
+	//scaled to the 99th percentile so a handful of very slow pixels do not flatten the rest
+	std::vector<float> sorted(values);
+	size_t nth = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+	float scale = 0;
+	if (!sorted.empty()) {
+		std::nth_element(sorted.begin(), sorted.begin() + nth, sorted.end());
+		scale = sorted[nth];
+	}
+	if (scale <= 0) scale = 1;
+
+	TGAImage heatmap(width, height, TGAImage::RGB);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			heatmap.set(x, y, false_colour(values[size_t(y) * width + x] / scale));
+	//same orientation as the main render
+	heatmap.flip_vertically();
+	heatmap.write_tga_file(filename.c_str());
+	std::cerr << "# " << filename << ": red is " << scale << " or more" << std::endl;
+}
+
+void aov_buffers::write(const std::string& prefix) const {
+	write_heatmap(node_visits, width, height, prefix + "_nodes.tga");
+	write_heatmap(triangle_tests, width, height, prefix + "_triangles.tga");
+	write_heatmap(path_depth, width, height, prefix + "_depth.tga");
+	write_heatmap(time_us, width, height, prefix + "_time.tga");
+}
@@ -0,0 +1,360 @@
+#pragma once
+#include "common.h"
+#include "scenes.h"
+#include "render.h"
+#include "wavefront.h"
+#include "counters.h"
+#include "image_metrics.h"
+#include "partial.h"
+#include "daemon.h"
+#include "checkpoint.h"
+#include "budget.h"
+#include "denoise.h"
+#include "tgaimage.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one render from the command line without a window, for machines with no display.
+// writes the image, prints the frame stats as a json line on stdout and returns the exit code
+struct batch_options {
+	std::string scene = "test";
+	int width = 1920;
+	int height = 1080;
+	int spp = 10;
+	int max_depth = 50;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t seed = 1;
+	// keep adding passes of spp samples until this many seconds have gone and/or total_spp samples are
+	// done, one pass if neither is set
+	double time_budget = 0;
+	int total_spp = 0;
+	// render for this many seconds and stop on time, with the spp picked from the measured speed, see budget.h
+	double deadline = 0;
+	// save the progress every checkpoint_interval seconds, see checkpoint.h. resume carries on from a
+	// checkpoint with its scene, size, spp, depth and seed
+	std::string checkpoint;
+	double checkpoint_interval = 60;
+	std::string resume;
+	std::string output = "raytracer_renderer.tga"; // .tga, or .pfm for linear floats
+	// filter the result guided by albedo, normals and depth, and/or write those as <features>_albedo.tga etc, see denoise.h
+	bool denoise = false;
+	std::string features;
+	bool wavefront = false;
+	bool sort_rays = false;
+	bool stream_rays = false;
+	// render only part of the image to a partial file for merge, see partial.h
+	std::string partial;
+	bool has_region = false;
+	pixel_rect region = { 0, 0, 0, 0 };
+	int tile_index = 0, tile_count = 0; // every tile_count'th tile from tile_index when tile_count > 0
+	int tile_size = 32;
+	// load the scene once and render the jobs sent to socket, see daemon.h
+	bool daemon = false;
+	std::string socket = "raytracer.sock";
+};
+
+inline void print_batch_usage(std::ostream& out) {
+	out << "usage: raytracer --headless [--scene test|spheres|dandelions] [--width N] [--height N] [--spp N] [--depth N]\n"
+		"                  [--threads N] [--seed N] [--time seconds] [--total-spp N] [--budget seconds]\n"
+		"                  [--output file.tga|file.pfm] [--denoise] [--features prefix]\n"
+		"                  [--checkpoint file [--checkpoint-interval seconds]] [--resume file]\n"
+		"                  [--wavefront] [--sort-rays] [--stream-rays]\n"
+		"                  [--partial file.part [--region x0,y0,x1,y1 | --tiles index/count [--tile-size N]]]\n"
+		"       raytracer --headless --daemon [--socket path] [--scene name] [--threads N]" << std::endl;
+}
+
+// whether the command line asks for a render without a window
+inline bool wants_batch(int argc, char** argv) {
+	for (int i = 1; i < argc; i++)
+		if (strcmp(argv[i], "--headless") == 0) return true;
+	return false;
+}
+
+// false with a message in error for anything it does not understand
+inline bool parse_batch_options(int argc, char** argv, batch_options& options, std::string& error) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool more = i + 1 < argc;
+		if (arg == "--headless") continue;
+		else if (arg == "--wavefront") options.wavefront = true;
+		else if (arg == "--sort-rays") options.sort_rays = true;
+		else if (arg == "--stream-rays") options.stream_rays = true;
+		else if (arg == "--denoise") options.denoise = true;
+		else if (arg == "--features" && more) options.features = argv[++i];
+		else if (arg == "--scene" && more) options.scene = argv[++i];
+		else if (arg == "--output" && more) options.output = argv[++i];
+		else if (arg == "--width" && more) options.width = atoi(argv[++i]);
+		else if (arg == "--height" && more) options.height = atoi(argv[++i]);
+		else if (arg == "--spp" && more) options.spp = atoi(argv[++i]);
+		else if (arg == "--depth" && more) options.max_depth = atoi(argv[++i]);
+		else if (arg == "--threads" && more) options.threads = atoi(argv[++i]);
+		else if (arg == "--seed" && more) options.seed = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--time" && more) options.time_budget = atof(argv[++i]);
+		else if (arg == "--total-spp" && more) options.total_spp = atoi(argv[++i]);
+		else if (arg == "--budget" && more) options.deadline = atof(argv[++i]);
+		else if (arg == "--checkpoint" && more) options.checkpoint = argv[++i];
+		else if (arg == "--checkpoint-interval" && more) options.checkpoint_interval = atof(argv[++i]);
+		else if (arg == "--resume" && more) options.resume = argv[++i];
+		else if (arg == "--daemon") options.daemon = true;
+		else if (arg == "--socket" && more) options.socket = argv[++i];
+		else if (arg == "--partial" && more) options.partial = argv[++i];
+		else if (arg == "--tile-size" && more) options.tile_size = atoi(argv[++i]);
+		else if (arg == "--region" && more) {
+			options.has_region = parse_rect(argv[++i], options.region);
+			if (!options.has_region) {
+				error = "--region wants x0,y0,x1,y1";
+				return false;
+			}
+		}
+		else if (arg == "--tiles" && more) {
+			char slash = 0;
+			std::istringstream in(argv[++i]);
+			if (!(in >> options.tile_index >> slash >> options.tile_count) || slash != '/' || options.tile_count < 1
+				|| options.tile_index < 0 || options.tile_index >= options.tile_count) {
+				error = "--tiles wants index/count with index below count";
+				return false;
+			}
+		}
+		else {
+			error = "unknown or incomplete argument " + arg;
+			return false;
+		}
+	}
+	if (options.width < 2 || options.height < 2 || options.spp < 1 || options.max_depth < 1 || options.threads < 1 || options.time_budget < 0) {
+		error = "width and height must be at least 2, spp, depth and threads at least 1 and time not negative";
+		return false;
+	}
+	if ((options.has_region || options.tile_count > 0) && options.partial.empty()) {
+		error = "--region and --tiles write a partial image, give it a file with --partial";
+		return false;
+	}
+	if (!options.partial.empty() && (options.wavefront || options.time_budget > 0 || options.total_spp > 0 || !options.checkpoint.empty() || !options.resume.empty()
+		|| options.denoise || !options.features.empty())) {
+		error = "--partial renders one pass with the classic renderer, without --wavefront, --time, --total-spp, --checkpoint, --resume, --denoise or --features";
+		return false;
+	}
+	if (options.has_region && (options.region.x0 < 0 || options.region.y0 < 0 || options.region.x1 > options.width
+		|| options.region.y1 > options.height || options.region.pixels() == 0)) {
+		error = "--region has to be a non empty rectangle inside the image";
+		return false;
+	}
+	if (options.deadline < 0) {
+		error = "--budget can not be negative";
+		return false;
+	}
+	if (options.deadline > 0 && (options.wavefront || options.time_budget > 0 || options.total_spp > 0 || !options.checkpoint.empty()
+		|| !options.resume.empty() || !options.partial.empty())) {
+		error = "--budget picks its own passes with the classic renderer, without --wavefront, --time, --total-spp, --checkpoint, --resume or --partial";
+		return false;
+	}
+	if (options.total_spp < 0 || options.checkpoint_interval < 0) {
+		error = "--total-spp and --checkpoint-interval can not be negative";
+		return false;
+	}
+	if (options.tile_size < 1) {
+		error = "--tile-size must be at least 1";
+		return false;
+	}
+	return true;
+}
+
+inline bool ends_with(const std::string& s, const std::string& suffix) {
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// the part of the image the options ask for, written to options.partial
+inline int run_partial(const batch_options& options, const scene_setup& setup, const camera& cam, const render_settings& settings) {
+	partial_image part;
+	part.width = options.width;
+	part.height = options.height;
+	part.scene = options.scene;
+	if (options.has_region) part.rects.push_back(options.region);
+	else if (options.tile_count > 0) part.rects = tile_subset(options.width, options.height, options.tile_size, options.tile_index, options.tile_count);
+	else part.rects.push_back({ 0, 0, options.width, options.height });
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	render_partial(setup.world, cam, settings, part);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+	if (!part.write(options.partial)) {
+		std::cerr << "could not write " << options.partial << std::endl;
+		return 1;
+	}
+	std::cerr << "Rendered " << part.sums.size() << " pixels in " << part.rects.size() << " rects at " << settings.spp << " spp in " << ms << " ms to " << options.partial << std::endl;
+	write_frame_json(std::cout, 0, ms, render_counter_registry::instance().collect());
+	return 0;
+}
+
+inline int run_batch(batch_options options) {
+	typedef std::chrono::high_resolution_clock clock;
+	auto t0 = clock::now();
+
+	//a checkpoint decides what is rendered, so it is read before the scene is built
+	checkpoint_header resumed;
+	std::vector<Colour> sums;
+	std::vector<uint32_t> samples;
+	uint64_t passes = 0;
+	if (!options.resume.empty()) {
+		if (!read_checkpoint(options.resume, resumed, sums, samples)) {
+			std::cerr << "could not read a checkpoint from " << options.resume << std::endl;
+			return 1;
+		}
+		options.scene = resumed.scene;
+		options.width = resumed.width;
+		options.height = resumed.height;
+		options.spp = resumed.spp;
+		options.max_depth = resumed.max_depth;
+		options.seed = resumed.seed;
+		passes = resumed.passes;
+		std::cerr << "Resuming " << options.scene << " " << options.width << "x" << options.height << " after " << passes << " passes of " << options.spp << " spp" << std::endl;
+	}
+	else {
+		sums.assign(size_t(options.width) * options.height, Colour(0, 0, 0));
+		samples.assign(sums.size(), 0);
+	}
+
+	//the bvh builds pick split axes at random, seeded so the same command gives the same image
+	seed_random(options.seed);
+	scene_setup setup;
+	if (!make_scene(options.scene, setup)) {
+		std::cerr << "no scene called " << options.scene << ", try";
+		for (const char* name : scene_names) std::cerr << " " << name;
+		std::cerr << std::endl;
+		return 2;
+	}
+	animate_scene(setup.world, 0);
+	camera cam = setup.make_camera(double(options.width) / options.height);
+	auto t1 = clock::now();
+	std::cerr << "Scene build time: " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms" << std::endl;
+	if (options.daemon) {
+#ifndef _WIN32
+		render_daemon daemon(setup, options.threads);
+		return daemon.serve(options.socket);
+#else
+		std::cerr << "--daemon needs unix domain sockets, it is not available on windows" << std::endl;
+		return 2;
+#endif
+	}
+
+	render_settings settings;
+	settings.width = options.width;
+	settings.height = options.height;
+	settings.spp = options.spp;
+	settings.max_depth = options.max_depth;
+	settings.threads = options.threads;
+	settings.seed = options.seed;
+	wavefront_renderer stages(options.width, options.height, options.spp, options.max_depth);
+	stages.threads = options.threads;
+	stages.sort_secondary = options.sort_rays;
+	stages.stream_extend = options.stream_rays;
+
+	render_counter_registry::instance().collect();
+	if (!options.partial.empty()) return run_partial(options, setup, cam, settings);
+	std::vector<Colour> pass;
+	checkpoint_writer writer;
+	auto last_checkpoint = clock::now();
+	int passes_run = 0;
+	double elapsed = 0;
+	if (options.deadline > 0) {
+		ThreadPool pool(static_cast<short>(options.threads));
+		budget_report report = render_within(setup.world, cam, settings, options.deadline * 1000, pool, sums, samples);
+		std::cerr << "Budget: first pass " << report.first_pass_ms << " ms, " << report.ms_per_spp << " ms per spp, " << report.min_spp << " to "
+			<< report.max_spp << " spp" << (report.cut ? ", the last pass stopped at the deadline" : "") << std::endl;
+		passes_run = report.passes;
+		elapsed = report.elapsed_ms / 1000;
+	}
+	//at least one pass unless a resumed render already has its total
+	auto more_passes = [&] {
+		bool short_of_total = options.total_spp > 0 && passes * options.spp < uint64_t(options.total_spp);
+		bool time_left = options.time_budget > 0 && elapsed < options.time_budget;
+		if (passes_run == 0) return options.total_spp == 0 || short_of_total;
+		if (options.total_spp > 0) return short_of_total && (options.time_budget == 0 || time_left);
+		return time_left;
+	};
+	while (options.deadline == 0 && more_passes()) {
+		//each pass gets samples of its own
+		uint64_t seed = pass_seed(options.seed, passes);
+		if (options.wavefront) {
+			stages.seed = seed;
+			stages.render(setup.world, cam, pass);
+		}
+		else {
+			settings.seed = seed;
+			render_image(setup.world, cam, settings, pass);
+		}
+		for (size_t i = 0; i < sums.size(); i++) {
+			sums[i] = sums[i] + pass[i];
+			samples[i] += options.spp;
+		}
+		passes++;
+		passes_run++;
+		auto now = clock::now();
+		elapsed = std::chrono::duration<double>(now - t1).count();
+
+		//copied here between passes and written by another thread while the next pass renders
+		if (!options.checkpoint.empty() && std::chrono::duration<double>(now - last_checkpoint).count() >= options.checkpoint_interval) {
+			checkpoint_header header = make_checkpoint_header(options.scene, options.width, options.height, options.spp, options.max_depth, options.seed, passes);
+			if (writer.write_async(options.checkpoint, header, sums, samples)) last_checkpoint = now;
+		}
+	}
+	if (!options.checkpoint.empty()) {
+		//the last one waits, so the file on disk always ends up with every pass
+		writer.wait();
+		checkpoint_header header = make_checkpoint_header(options.scene, options.width, options.height, options.spp, options.max_depth, options.seed, passes);
+		if (!write_checkpoint(options.checkpoint, header, sums, samples) || !writer.wait())
+			std::cerr << "could not write the checkpoint " << options.checkpoint << std::endl;
+	}
+	uint64_t spp = passes * options.spp;
+	if (options.deadline > 0) spp = *std::min_element(samples.begin(), samples.end());
+
+	//every pixel's average, as a sum of one sample
+	std::vector<Colour> average(sums.size(), Colour(0, 0, 0));
+	for (size_t i = 0; i < sums.size(); i++)
+		if (samples[i] > 0) average[i] = sums[i] / float(samples[i]);
+	if (options.denoise || !options.features.empty()) {
+		ThreadPool pool(static_cast<short>(options.threads));
+		feature_buffers features;
+		auto t_features = clock::now();
+		features.render(setup.world, cam, options.width, options.height, pool);
+		if (!options.features.empty() && !features.write(options.features))
+			std::cerr << "could not write the features to " << options.features << "_*.tga" << std::endl;
+		if (options.denoise) {
+			double total = 0;
+			for (uint32_t n : samples) total += n;
+			denoise(average, features, denoise_settings(), float(total / samples.size()), pool, average);
+		}
+		std::cerr << "Features" << (options.denoise ? " and denoise: " : ": ") << std::chrono::duration<double, std::milli>(clock::now() - t_features).count() << " ms" << std::endl;
+	}
+
+	bool written;
+	if (ends_with(options.output, ".pfm")) {
+		for (Colour& c : average) c = c / 255.f;
+		written = write_pfm(options.output, average, options.width, options.height);
+	}
+	else {
+		written = to_image(average, options.width, options.height, 1).write_tga_file(options.output.c_str());
+	}
+	if (!written) {
+		std::cerr << "could not write " << options.output << std::endl;
+		return 1;
+	}
+
+	std::cerr << "Rendered " << options.width << "x" << options.height << " at " << spp << " spp (" << passes_run << " passes this run) in " << elapsed * 1000 << " ms to " << options.output << std::endl;
+	write_frame_json(std::cout, 0, elapsed * 1000, render_counter_registry::instance().collect());
+	return 0;
+}
+
+// main for --headless, and for the whole program when it is built without SDL
+inline int batch_main(int argc, char** argv) {
+	batch_options options;
+	std::string error;
+	if (!parse_batch_options(argc, argv, options, error)) {
+		std::cerr << error << std::endl;
+		print_batch_usage(std::cerr);
+		return 2;
+	}
+	return run_batch(options);
+}
@@ -0,0 +1,395 @@
+// Microbenchmarks for the ray tracer kernels, separate from the interactive app so it builds
+// without SDL. see README.md for the build command. every run reseeds the generator so the inputs are
+// the same from run to run and commit to commit. before timing anything it checks the fast paths
+// give the same answers as the plain ones, and exits with 1 if they do not.
+//
+// usage: benchmark [--reps N] [--filter text]
+
+#include "common.h"
+#include "aabb.h"
+#include "sphere.h"
+#include "triangles.h"
+#include "material.h"
+#include "Texture.h"
+#include "rtw_stb_image.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "ray_stream.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+static const unsigned seed = 12345;
+
+// results are folded into this so the compiler can not drop the work being timed
+static volatile double sink;
+
+struct benchmark_options {
+	int reps = 15;
+	std::string filter;
+};
+
+// times fn, which does ops operations, reps times after one warm up run and prints
+// the median, mean, standard deviation and best time per operation
+static void run(const benchmark_options& options, const std::string& name, size_t ops, const std::function<double()>& fn) {
+	if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+
+	seed_random(seed);
+	sink = sink + fn();
+	std::vector<double> ns;
+	for (int r = 0; r < options.reps; r++) {
+		seed_random(seed);
+		auto t0 = std::chrono::high_resolution_clock::now();
+		double result = fn();
+		auto t1 = std::chrono::high_resolution_clock::now();
+		sink = sink + result;
+		ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / ops);
+	}
+
+	std::sort(ns.begin(), ns.end());
+	double median = ns[ns.size() / 2];
+	double mean = 0;
+	for (double v : ns) mean += v;
+	mean /= ns.size();
+	double var = 0;
+	for (double v : ns) var += (v - mean) * (v - mean);
+	double stddev = ns.size() > 1 ? sqrt(var / (ns.size() - 1)) : 0;
+	printf("%-36s %10zu %14.2f %14.2f %12.2f %14.2f %14.3f\n", name.c_str(), ops, median, mean, stddev, ns.front(), 1e3 / median);
+}
+
+static Vec3f random_unit_vector() {
+	Vec3f v = Vec3f().random_in_unit_sphere();
+	return v.normalize();
+}
+
+// rays from a sphere around box aimed at random points inside it, so most of them hit something
+static std::vector<Ray> rays_towards(const aabb& box, size_t count) {
+	seed_random(seed);
+	Vec3f extent = box.max() - box.min();
+	Point3f centre = box.min() + extent * 0.5f;
+	float radius = extent.length();
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < count; i++) {
+		Point3f from = centre + random_unit_vector() * radius;
+		Point3f to(box.min().x + random_double() * extent.x, box.min().y + random_double() * extent.y, box.min().z + random_double() * extent.z);
+		rays.push_back(Ray(from, to - from));
+	}
+	return rays;
+}
+
+// shadow rays from random points inside box to one light off a corner of it, so every ray points the same
+// way on all three axes like the ones a wavefront shadow pass sends together
+static std::vector<Ray> rays_from_light(const aabb& box, size_t count) {
+	seed_random(seed);
+	Vec3f extent = box.max() - box.min();
+	Point3f light = box.max() + extent;
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < count; i++) {
+		Point3f from(box.min().x + random_double() * extent.x, box.min().y + random_double() * extent.y, box.min().z + random_double() * extent.z);
+		rays.push_back(Ray(from, light - from));
+	}
+	return rays;
+}
+
+static void primitive_benchmarks(const benchmark_options& options) {
+	const size_t count = 1 << 16;
+
+	hittable_list mesh = load_triangles("Damdelion.obj", 0);
+	aabb bounds;
+	mesh.bounding_box(bounds);
+	std::vector<Ray> rays = rays_towards(bounds, count);
+
+	if (!mesh.objects.empty()) {
+		const triangle* tri = static_cast<const triangle*>(mesh.objects[mesh.objects.size() / 2].get());
+		aabb tri_box;
+		tri->bounding_box(tri_box);
+		std::vector<Ray> tri_rays = rays_towards(tri_box, count);
+		run(options, "triangle::hit", count, [&] {
+			hit_record rec;
+			double hits = 0;
+			for (const Ray& r : tri_rays) hits += tri->hit(r, 0.001, infinity, rec);
+			return hits;
+		});
+	}
+
+	sphere ball(Point3f(0, 0, 0), 1.0, 0);
+	std::vector<Ray> sphere_rays = rays_towards(aabb(Point3f(-1, -1, -1), Point3f(1, 1, 1)), count);
+	run(options, "sphere::hit", count, [&] {
+		hit_record rec;
+		double hits = 0;
+		for (const Ray& r : sphere_rays) hits += ball.hit(r, 0.001, infinity, rec);
+		return hits;
+	});
+
+	aabb box(Point3f(-1, -1, -1), Point3f(1, 1, 1));
+	run(options, "aabb::hit", count, [&] {
+		double hits = 0;
+		for (const Ray& r : sphere_rays) hits += box.hit(r, 0.001, infinity);
+		return hits;
+	});
+
+	run(options, "random_double", count, [&] {
+		double total = 0;
+		for (size_t i = 0; i < count; i++) total += random_double();
+		return total;
+	});
+}
+
+// the scalar slab test aabb::hit uses without sse, an axis with a NaN is skipped
+static bool scalar_box_hit(const aabb& box, const Ray& r, double t_min, double t_max) {
+	float t0 = static_cast<float>(t_min), t1 = static_cast<float>(t_max);
+	for (int a = 0; a < 3; a++) {
+		float near_t = ((r.sign[a] ? box.maximum[a] : box.minimum[a]) - r.origin()[a]) * r.inv_direction()[a];
+		float far_t = ((r.sign[a] ? box.minimum[a] : box.maximum[a]) - r.origin()[a]) * r.inv_direction()[a];
+		t0 = near_t > t0 ? near_t : t0;
+		t1 = far_t < t1 ? far_t : t1;
+	}
+	return t0 < t1;
+}
+
+// random boxes and rays, with some direction components +0 or -0 and some origins on a slab plane.
+// aabb::hit against the scalar slab test, and the ray_stream box filter against aabb::hit
+static int check_box_hits() {
+	seed_random(seed);
+	int mismatches = 0;
+	ray_stream one;
+	one.resize(1);
+	hit_stream one_hit;
+	one_hit.reset(one, false);
+	uint32_t id = 0;
+	for (int i = 0; i < 1000000; i++) {
+		Point3f lo(random_double(-2, 1), random_double(-2, 1), random_double(-2, 1));
+		aabb box(lo, lo + Vec3f(random_double(0, 2), random_double(0, 2), random_double(0, 2)));
+		Point3f o(random_double(-3, 3), random_double(-3, 3), random_double(-3, 3));
+		Vec3f d(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+		for (int a = 0; a < 3; a++) {
+			int kind = (i / (a == 0 ? 1 : a == 1 ? 5 : 25)) % 5;
+			if (kind == 1 || kind == 2) d[a] = kind == 1 ? 0.0f : -0.0f;
+			//the origin on the min or max plane of an axis the ray runs along
+			if (kind == 2 || kind == 3) o[a] = (i & 1) ? box.minimum[a] : box.maximum[a];
+			if (kind == 3) d[a] = (i & 2) ? 0.0f : -0.0f;
+		}
+		Ray r(o, d);
+		double t_max = (i % 3) ? infinity : random_double(0, 5);
+		bool hit = box.hit(r, 0.001, t_max);
+		if (hit != scalar_box_hit(box, r, 0.001, t_max)) mismatches++;
+		one.set(0, r, 0.001, t_max);
+		one_hit.closest[0] = one.t_max[0];
+		if (hit != (filter_box(box, one, &id, 1, one_hit) == 1)) mismatches++;
+	}
+	//a ray along the bottom face of a box, a +0 direction component with the origin on the min plane
+	aabb unit(Point3f(0, 0, 0), Point3f(1, 1, 1));
+	Ray along(Point3f(-1, 0.5f, 0), Vec3f(1, 0, 0));
+	if (!unit.hit(along, 0.001, infinity)) mismatches++;
+	one.set(0, along, 0.001, infinity);
+	one_hit.closest[0] = one.t_max[0];
+	if (filter_box(unit, one, &id, 1, one_hit) != 1) mismatches++;
+	return mismatches;
+}
+
+static const char* const bvh_meshes[] = { "Table.obj", "Damdelion.obj", "Water.obj", "WaterBall.obj", "AreaLight.obj" };
+
+// closest hits through the compressed nodes against the bvh they were packed from, same hit and same t
+static int check_compressed_hits() {
+	int mismatches = 0;
+	for (const char* filename : bvh_meshes) {
+		hittable_list mesh = load_triangles(filename, 0);
+		if (mesh.objects.empty()) continue;
+		seed_random(seed);
+		bvh_node bvh(mesh, bvh_build_options());
+		compressed_bvh packed(bvh);
+		for (const Ray& r : rays_towards(bvh.box, 1 << 15)) {
+			hit_record a, b;
+			bool hit_a = bvh.hit(r, 0.001, infinity, a), hit_b = packed.hit(r, 0.001, infinity, b);
+			if (hit_a != hit_b || (hit_a && a.t != b.t)) mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+// the single ray and stream shadow tests against whether there is a closest hit at all. the rays towards
+// the mesh point every way so the stream hands them on one at a time, the light rays go through the
+// stream traversal
+static int check_occlusion() {
+	int mismatches = 0;
+	for (const char* filename : bvh_meshes) {
+		hittable_list mesh = load_triangles(filename, 0);
+		if (mesh.objects.empty()) continue;
+		seed_random(seed);
+		bvh_node bvh(mesh, bvh_build_options());
+		compressed_bvh packed(bvh);
+		std::vector<Ray> rays = rays_towards(bvh.box, 1 << 15);
+		std::vector<Ray> light = rays_from_light(bvh.box, 1 << 15);
+		rays.insert(rays.end(), light.begin(), light.end());
+		ray_stream stream;
+		for (size_t i = 0; i < rays.size(); i++) {
+			//short rays too, so some stop before anything
+			stream.add(rays[i], 0.001, (i % 2) ? infinity : random_double(0, 50));
+		}
+		std::vector<uint8_t> blocked;
+		occluded(bvh, stream, blocked);
+		for (size_t i = 0; i < rays.size(); i++) {
+			hit_record rec;
+			bool hit = bvh.hit(rays[i], stream.t_min[i], stream.t_max[i], rec);
+			if (bvh.occluded(rays[i], stream.t_min[i], stream.t_max[i]) != hit) mismatches++;
+			if (packed.occluded(rays[i], stream.t_min[i], stream.t_max[i]) != hit) mismatches++;
+			if ((blocked[i] != 0) != hit) mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+static int run_checks() {
+	int box = check_box_hits();
+	printf("# check aabb::hit against the scalar slab test and the stream box filter: %d mismatches\n", box);
+	int compressed = check_compressed_hits();
+	printf("# check compressed_bvh::hit against bvh_node::hit: %d mismatches\n", compressed);
+	int occlusion = check_occlusion();
+	printf("# check occluded, one ray and streams, against closest hits: %d mismatches\n", occlusion);
+	return box + compressed + occlusion;
+}
+
+static void bvh_benchmarks(const benchmark_options& options) {
+	const size_t count = 1 << 15;
+
+	for (const char* filename : bvh_meshes) {
+		hittable_list mesh = load_triangles(filename, 0);
+		if (mesh.objects.empty()) continue;
+		std::string name(filename);
+
+		bvh_build_options object_split, spatial_split;
+		spatial_split.split_mode = bvh_split_mode::spatial;
+		run(options, "bvh build object " + name, 1, [&] {
+			bvh_node bvh(mesh, object_split);
+			return bvh.box.surface_area();
+		});
+		run(options, "bvh build spatial " + name, 1, [&] {
+			bvh_node bvh(mesh, spatial_split);
+			return bvh.box.surface_area();
+		});
+
+		seed_random(seed);
+		bvh_node bvh(mesh, object_split);
+		std::vector<Ray> rays = rays_towards(bvh.box, count);
+		run(options, "bvh closest hit " + name, count, [&] {
+			hit_record rec;
+			double hits = 0;
+			for (const Ray& r : rays) hits += bvh.hit(r, 0.001, infinity, rec);
+			return hits;
+		});
+
+		compressed_bvh packed(bvh);
+		run(options, "bvh compressed hit " + name, count, [&] {
+			hit_record rec;
+			double hits = 0;
+			for (const Ray& r : rays) hits += packed.hit(r, 0.001, infinity, rec);
+			return hits;
+		});
+
+		run(options, "bvh occluded " + name, count, [&] {
+			double hits = 0;
+			for (const Ray& r : rays) hits += bvh.occluded(r, 0.001, infinity);
+			return hits;
+		});
+
+		ray_stream stream;
+		for (const Ray& r : rays) stream.add(r);
+		run(options, "bvh any hit " + name, count, [&] {
+			std::vector<uint8_t> blocked;
+			occluded(bvh, stream, blocked);
+			double hits = 0;
+			for (uint8_t b : blocked) hits += b;
+			return hits;
+		});
+
+		std::vector<Ray> shadow = rays_from_light(bvh.box, count);
+		run(options, "bvh occluded light " + name, count, [&] {
+			double hits = 0;
+			for (const Ray& r : shadow) hits += bvh.occluded(r, 0.001, 1);
+			return hits;
+		});
+
+		ray_stream shadow_stream;
+		for (const Ray& r : shadow) shadow_stream.add(r, 0.001, 1);
+		run(options, "bvh any hit light " + name, count, [&] {
+			std::vector<uint8_t> blocked;
+			occluded(bvh, shadow_stream, blocked);
+			double hits = 0;
+			for (uint8_t b : blocked) hits += b;
+			return hits;
+		});
+	}
+}
+
+static void shading_benchmarks(const benchmark_options& options) {
+	const size_t count = 1 << 16;
+
+	material_table materials;
+	struct named { const char* name; int id; };
+	named kinds[] = {
+		{ "scatter lambertian", materials.add(lambertian(Colour(0.5, 0.5, 0.5))) },
+		{ "scatter lambertian textured", materials.add(lambertian(make_shared<image_texture>("TableUvs.jpg"))) },
+		{ "scatter metal", materials.add(metal(Colour(0.5, 0.5, 0.5), 0.1)) },
+		{ "scatter dielectric", materials.add(dielectric(1.5)) },
+		{ "scatter water", materials.add(Water(1.3)) },
+		{ "scatter diffuse_light", materials.add(diffuse_light(Colour(255, 255, 255))) },
+	};
+
+	//hits on a unit sphere seen from random directions, half of them from inside
+	seed_random(seed);
+	std::vector<Ray> rays;
+	std::vector<hit_record> records;
+	for (size_t i = 0; i < count; i++) {
+		hit_record rec;
+		Vec3f n = random_unit_vector();
+		rec.p = n;
+		rec.t = 1;
+		rec.u = random_double();
+		rec.v = random_double();
+		Vec3f in = random_unit_vector();
+		if (in.dotProduct(n) > 0) in = -in;
+		rec.front_face = (i % 2) == 0;
+		rec.normal = rec.front_face ? n : -n;
+		rays.push_back(Ray(rec.p - in, in));
+		records.push_back(rec);
+	}
+
+	for (const named& kind : kinds) {
+		run(options, kind.name, count, [&] {
+			double total = 0;
+			Colour attenuation;
+			Ray scattered;
+			for (size_t i = 0; i < count; i++) {
+				if (materials.scatter(kind.id, rays[i], records[i], attenuation, scattered)) total += attenuation.x + scattered.direction().y;
+			}
+			return total;
+		});
+	}
+
+	image_texture texture("TableUvs.jpg");
+	run(options, "image_texture::colour_Value", count, [&] {
+		double total = 0;
+		for (size_t i = 0; i < count; i++) total += texture.colour_Value(records[i].u, records[i].v, records[i].p).x;
+		return total;
+	});
+}
+
+int main(int argc, char** argv) {
+	benchmark_options options;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) options.reps = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) options.filter = argv[++i];
+	}
+
+	if (run_checks() > 0) return 1;
+	printf("%-36s %10s %14s %14s %12s %14s %14s\n", "benchmark", "ops", "median ns/op", "mean ns/op", "stddev", "min ns/op", "Mops/s");
+	primitive_benchmarks(options);
+	bvh_benchmarks(options);
+	shading_benchmarks(options);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include "render.h"
+#include "Multithreading.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// renders for a fixed amount of time instead of a fixed number of samples. a first pass of one sample
+// per pixel measures how fast the scene renders, then each pass is sized to fill most of the time left.
+// no tile is started after the deadline, so the last pass may stop part way through and leave some
+// tiles with one pass fewer. sums and samples are per pixel, so the average stays right either way
+
+struct budget_report {
+	int passes = 0;
+	bool cut = false;          // the last pass stopped at the deadline
+	double first_pass_ms = 0;
+	double ms_per_spp = 0;     // estimated time for one sample on every pixel
+	double elapsed_ms = 0;
+	uint32_t min_spp = 0, max_spp = 0;
+};
+
+typedef std::chrono::high_resolution_clock budget_clock;
+
+// adds settings.spp samples to every pixel of the tiles started before the deadline, true if it got
+// through them all. the seed of every pixel comes from settings.seed as in render_pixel
+bool render_tiles_until(const scene& world, const camera& cam, const render_settings& settings, ThreadPool& pool,
+	budget_clock::time_point deadline, std::vector<Colour>& sums, std::vector<uint32_t>& samples, int tile_size = 16) {
+	std::mutex mutex;
+	std::condition_variable finished;
+	int tiles_left = 0;
+	bool complete = true;
+	for (int ty = 0; ty < settings.height; ty += tile_size)
+		for (int tx = 0; tx < settings.width; tx += tile_size)
+			tiles_left++;
+
+	for (int ty = 0; ty < settings.height; ty += tile_size) {
+		for (int tx = 0; tx < settings.width; tx += tile_size) {
+			pool.Enqueue([&, tx, ty] {
+				bool in_time = budget_clock::now() < deadline;
+				if (in_time) {
+					for (int y = ty; y < std::min(settings.height, ty + tile_size); y++) {
+						for (int x = tx; x < std::min(settings.width, tx + tile_size); x++) {
+							size_t i = size_t(y) * settings.width + x;
+							sums[i] = sums[i] + render_pixel(world, cam, x, y, settings.width, settings.height, settings.spp, settings.max_depth, settings.seed);
+							samples[i] += settings.spp;
+						}
+					}
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!in_time) complete = false;
+				if (--tiles_left == 0) finished.notify_all();
+			});
+		}
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&tiles_left] { return tiles_left == 0; });
+	return complete;
+}
+
+// renders into sums and samples, which start at zero, for budget_ms. settings.spp is not used, the
+// passes choose their own. pass p is seeded with pass_seed(settings.seed, p)
+budget_report render_within(const scene& world, const camera& cam, render_settings settings, double budget_ms, ThreadPool& pool,
+	std::vector<Colour>& sums, std::vector<uint32_t>& samples) {
+	budget_report report;
+	sums.assign(size_t(settings.width) * settings.height, Colour(0, 0, 0));
+	samples.assign(sums.size(), 0);
+	auto start = budget_clock::now();
+	auto deadline = start + std::chrono::duration_cast<budget_clock::duration>(std::chrono::duration<double, std::milli>(budget_ms));
+	uint64_t first_seed = settings.seed;
+
+	int spp = 1;
+	while (true) {
+		settings.spp = spp;
+		settings.seed = pass_seed(first_seed, report.passes);
+		auto t0 = budget_clock::now();
+		bool complete = render_tiles_until(world, cam, settings, pool, deadline, sums, samples);
+		double pass_ms = std::chrono::duration<double, std::milli>(budget_clock::now() - t0).count();
+		report.passes++;
+		if (!complete) {
+			report.cut = true;
+			break;
+		}
+
+		//the first pass sets the rate, later ones are blended in as the caches warm up and lazy bvh nodes get built
+		double rate = pass_ms / spp;
+		if (report.passes == 1) {
+			report.first_pass_ms = pass_ms;
+			report.ms_per_spp = rate;
+		}
+		else {
+			report.ms_per_spp = 0.5 * report.ms_per_spp + 0.5 * rate;
+		}
+
+		double remaining = std::chrono::duration<double, std::milli>(deadline - budget_clock::now()).count();
+		if (remaining <= 0) break;
+		//most of what is left, keeping some back for the estimate being off. once less than one
+		//sample per pixel fits the last pass is a single sample, stopped by the deadline part way through
+		spp = std::max(1, static_cast<int>(remaining * 0.8 / std::max(report.ms_per_spp, 1e-6)));
+	}
+
+	report.elapsed_ms = std::chrono::duration<double, std::milli>(budget_clock::now() - start).count();
+	auto range = std::minmax_element(samples.begin(), samples.end());
+	if (!samples.empty()) {
+		report.min_spp = *range.first;
+		report.max_spp = *range.second;
+	}
+	return report;
+}
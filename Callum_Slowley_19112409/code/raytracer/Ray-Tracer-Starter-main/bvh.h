@@ -2,19 +2,81 @@
 #include "common.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "Multithreading.h"
+#include "ray_stream.h"
 #include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
 
+// object splits partition whole primitives, spatial splits (SBVH, Stich et al. 2009) may also cut
+// a primitive at the split plane and reference it from both children with the clipped bounds.
+// spatial splits pay off on long thin triangles whose boxes overlap a lot, like the dandelion stems
+enum class bvh_split_mode { object, spatial };
 
+// shape of a built tree, for comparing builders. a leaf is a node with a primitive child
+struct bvh_stats {
+	size_t nodes = 0;
+	size_t leaves = 0;
+	size_t primitives = 0; // references, more than the primitive count after spatial splits
+	size_t deferred = 0; // lazy subtrees not built yet, not in the histograms
+	int max_depth = 0;
+	double sah_cost = 0;
+	double overlap = 0; // summed area where sibling boxes intersect, relative to the root area
+	std::vector<size_t> depth_histogram; // leaves at each depth
+	std::vector<size_t> leaf_histogram; // leaves by number of primitives
+
+	void print(std::ostream& out, const std::string& name) const;
+};
+
+struct bvh_build_options {
+	bvh_split_mode split_mode = bvh_split_mode::object;
+	// cap on the extra references spatial splits may create, as a fraction of the primitive count
+	double max_duplication = 0.5;
+	// only try a spatial split when the object split children overlap by more than this fraction of the root area
+	double overlap_threshold = 1e-5;
+	// build only the top eager_depth levels now and the rest the first time a ray enters them
+	bool lazy = false;
+	int eager_depth = 8;
+	// pack the finished tree into quantized nodes, see compressed_bvh.h. builds lazy subtrees straight away.
+	// opt in only, no scene sets it: the bundled meshes' trees already fit in L2 and decoding the boxes
+	// makes traversal slower or no faster on them
+	bool compress = false;
+
+	// every field as text, equal only for options that build the same tree
+	std::string key() const {
+		std::ostringstream out;
+		out.precision(17);
+		out << int(split_mode) << ' ' << max_duplication << ' ' << overlap_threshold << ' ' << lazy << ' ' << eager_depth << ' ' << compress;
+		return out.str();
+	}
+};
 
 class bvh_node : public hittable {
 public:
 	bvh_node();
 	bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+	bvh_node(const hittable_list& list, const bvh_build_options& options);
+	bvh_node(shared_ptr<hittable> l, shared_ptr<hittable> r, const aabb& b) : left(l), right(r), box(b) {}
 
-	bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end);
+	bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, const bvh_build_options* lazy = nullptr, int depth = 0);
 
 	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec)const override;
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override;
 	virtual bool bounding_box(aabb& output_box)const override;
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const override;
+
+	// bottom up bounds update after the primitives moved, the topology is kept as built
+	virtual void refit() override;
+	// refits the subtrees below split_depth on a thread pool and then the few nodes above them
+	void refit_parallel(int split_depth);
+	// surface area heuristic cost relative to the root box, with unit traversal and intersection costs
+	// with expansions, also what the lazy subtrees built since added to the cost when they were built
+	double sah_cost(double* expansions = nullptr) const;
+	// walks the tree without building any lazy subtrees
+	bvh_stats stats() const;
 
 public: //left and right pointers for primitives to spilt hierarchy
 	shared_ptr<hittable> left;
@@ -27,6 +89,99 @@ bool bvh_node::bounding_box(aabb& output_box) const {
 	return true;
 }
 
+// a subtree that has not been built yet. only its box and primitives are known until the first ray
+// gets through the box, then one thread builds it while any others entering at the same time wait
+class lazy_bvh_node : public hittable {
+public:
+	lazy_bvh_node(std::vector<shared_ptr<hittable>> objects, const bvh_build_options& opts);
+
+	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override {
+		if (!box.hit(r, t_min, t_max)) return false;
+		return subtree()->hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override {
+		return box.hit(r, t_min, t_max) && subtree()->occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = box;
+		return true;
+	}
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const override {
+		size_t n = filter_box(box, rays, ids, count, hits);
+		if (n > 0) subtree()->hit_stream_subset(rays, ids, n, hits);
+	}
+	virtual void refit() override;
+
+	bool built() const { return ready.load(std::memory_order_acquire); }
+	// how much more the sah cost was with the subtree built than with this node as a leaf, once built
+	double expansion_cost() const { return built() ? expanded_by : 0; }
+	size_t pending_count() const { return built() ? 0 : pending.size(); }
+	const hittable* subtree() const {
+		if (!built()) std::call_once(once, [this] { expand(); });
+		return tree.get();
+	}
+
+public:
+	aabb box;
+
+private:
+	void expand() const;
+
+	mutable std::vector<shared_ptr<hittable>> pending;
+	mutable shared_ptr<hittable> tree;
+	mutable std::once_flag once;
+	mutable std::atomic<bool> ready;
+	mutable double expanded_by = 0;
+	bvh_build_options options;
+};
+
+// cost of the subtree under node, into lazy subtrees that are built, see bvh_node::sah_cost
+inline double subtree_sah_cost(const hittable* node, double* expansions = nullptr);
+
+inline aabb objects_bounds(const std::vector<shared_ptr<hittable>>& objects) {
+	aabb bounds, temp_box;
+	for (size_t i = 0; i < objects.size(); i++) {
+		objects[i]->bounding_box(temp_box);
+		bounds = i == 0 ? temp_box : surrounding_box(bounds, temp_box);
+	}
+	return bounds;
+}
+
+lazy_bvh_node::lazy_bvh_node(std::vector<shared_ptr<hittable>> objects, const bvh_build_options& opts)
+	: pending(std::move(objects)), ready(false), options(opts) {
+	box = objects_bounds(pending);
+}
+
+void lazy_bvh_node::expand() const {
+	//the build picks split axes at random. it draws from a stream of its own and leaves the render thread's
+	//alone, so neither the tree nor the samples of the pixel that first reached it depend on thread timing
+	uint64_t caller = random_state();
+	seed_random(pending.size());
+	hittable_list list;
+	list.objects.swap(pending);
+	tree = make_shared<bvh_node>(list, options);
+	random_state() = caller;
+	expanded_by = subtree_sah_cost(tree.get()) - box.surface_area();
+	ready.store(true, std::memory_order_release);
+}
+
+void lazy_bvh_node::refit() {
+	if (built()) {
+		tree->refit();
+		tree->bounding_box(box);
+	}
+	else {
+		box = objects_bounds(pending);
+	}
+}
+
+//object split children, deferred once the build is deep enough
+inline shared_ptr<hittable> make_bvh_child(const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, const bvh_build_options* lazy, int depth) {
+	if (lazy && depth >= lazy->eager_depth && end - start > 2)
+		return make_shared<lazy_bvh_node>(std::vector<shared_ptr<hittable>>(objects.begin() + start, objects.begin() + end), *lazy);
+	return make_shared<bvh_node>(objects, start, end, lazy, depth);
+}
+
 inline bool box_compare(const shared_ptr<hittable>a, const shared_ptr<hittable>b, int axis) {
 	aabb box_a;
 	aabb box_b;
@@ -47,11 +202,11 @@ bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
 	return box_compare(a, b, 2);
 }
 
-bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, const bvh_build_options* lazy, int depth) {
 	auto objects = src_objects;
 
 	int axis = random_int(0, 2);
-	auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_x_compare;
+	auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
 	
 	size_t object_span = end - start;
 	if (object_span == 1) { left = right = objects[start]; }
@@ -71,8 +226,8 @@ bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t
 		std::sort(objects.begin() + start, objects.begin() + end, comparator);
 		
 		auto mid = start + object_span / 2;
-		left = make_shared<bvh_node>(objects, start, mid);
-		right = make_shared<bvh_node>(objects, mid, end);
+		left = make_bvh_child(objects, start, mid, lazy, depth + 1);
+		right = make_bvh_child(objects, mid, end, lazy, depth + 1);
 	}
 
 	aabb box_left, box_right;
@@ -85,11 +240,497 @@ bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t
 }
 
 bool bvh_node::hit(const Ray& r, double t_min, double t_max, hit_record& rec)const {
+	counters().node_visits++;
 	if (!box.hit(r, t_min, t_max))
 		return false;
 	bool hit_left = left->hit(r, t_min, t_max, rec);
+	//single primitive leaves point both children at the same object
+	if (right == left)
+		return hit_left;
 	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
 	return hit_left || hit_right;
 }
 
+bool bvh_node::occluded(const Ray& r, double t_min, double t_max) const {
+	counters().node_visits++;
+	if (!box.hit(r, t_min, t_max)) return false;
+	//any blocker will do, so there is no need to find the nearer child first
+	if (left->occluded(r, t_min, t_max)) return true;
+	return right != left && right->occluded(r, t_min, t_max);
+}
+
+void bvh_node::hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const {
+	//the group is narrowed to the rays that enter this box, and each child sees the closest hits the other found
+	counters().node_visits++;
+	size_t n = filter_box(box, rays, ids, count, hits);
+	if (n == 0) return;
+	if (right == left) {
+		left->hit_stream_subset(rays, ids, n, hits);
+		return;
+	}
+	//nearer child first along the first ray of the group, so closest hits shrink sooner. shadow rays
+	//take any blocker, so like occluded they skip the two box lookups
+	const hittable* first = left.get();
+	const hittable* second = right.get();
+	if (!hits.any_hit) {
+		aabb left_box, right_box;
+		left->bounding_box(left_box);
+		right->bounding_box(right_box);
+		Vec3f apart = (right_box.min() + right_box.max()) - (left_box.min() + left_box.max());
+		uint32_t lead = ids[0];
+		if (apart.x * rays.dx[lead] + apart.y * rays.dy[lead] + apart.z * rays.dz[lead] < 0) std::swap(first, second);
+	}
+	first->hit_stream_subset(rays, ids, n, hits);
+	//rays the first child blocked are done with
+	if (hits.any_hit) {
+		n = std::partition(ids, ids + n, [&hits](uint32_t i) { return hits.found[i] == 0; }) - ids;
+		if (n == 0) return;
+	}
+	second->hit_stream_subset(rays, ids, n, hits);
+}
+
+void bvh_node::refit() {
+	left->refit();
+	if (right != left) right->refit();
+
+	aabb box_left, box_right;
+	left->bounding_box(box_left);
+	right->bounding_box(box_right);
+	box = surrounding_box(box_left, box_right);
+}
+
+inline void gather_subtrees(const shared_ptr<hittable>& node, int depth, std::vector<hittable*>& roots) {
+	auto inner = dynamic_cast<bvh_node*>(node.get());
+	if (!inner || depth == 0) {
+		roots.push_back(node.get());
+		return;
+	}
+	gather_subtrees(inner->left, depth - 1, roots);
+	if (inner->right != inner->left) gather_subtrees(inner->right, depth - 1, roots);
+}
+
+//recomputes the boxes of the nodes above depth, the subtrees below are already up to date
+inline void refit_above(bvh_node& node, int depth) {
+	if (depth > 0) {
+		auto l = dynamic_cast<bvh_node*>(node.left.get());
+		auto r = dynamic_cast<bvh_node*>(node.right.get());
+		if (l) refit_above(*l, depth - 1);
+		if (r && r != l) refit_above(*r, depth - 1);
+	}
+	aabb box_left, box_right;
+	node.left->bounding_box(box_left);
+	node.right->bounding_box(box_right);
+	node.box = surrounding_box(box_left, box_right);
+}
+
+void bvh_node::refit_parallel(int split_depth) {
+	if (split_depth < 1) {
+		refit();
+		return;
+	}
+	std::vector<hittable*> roots;
+	gather_subtrees(left, split_depth - 1, roots);
+	if (right != left) gather_subtrees(right, split_depth - 1, roots);
+	{
+		ThreadPool pool(std::thread::hardware_concurrency());
+		for (auto node : roots) pool.Enqueue([node] { node->refit(); });
+	}
+	refit_above(*this, split_depth - 1);
+}
+
+//a primitive is tested whenever its parent is visited. a lazy subtree not built yet counts as one
+//primitive the size of its box, a built one as the tree it became
+inline double child_sah_cost(const hittable* child, double parent_area, double* expansions) {
+	if (dynamic_cast<const bvh_node*>(child)) return subtree_sah_cost(child, expansions);
+	if (auto lazy = dynamic_cast<const lazy_bvh_node*>(child)) {
+		if (!lazy->built()) return lazy->box.surface_area();
+		if (expansions) *expansions += lazy->expansion_cost();
+		return subtree_sah_cost(lazy->subtree(), expansions);
+	}
+	return parent_area;
+}
+
+inline double subtree_sah_cost(const hittable* node, double* expansions) {
+	auto inner = dynamic_cast<const bvh_node*>(node);
+	if (!inner) return 0;
+	//every visit to a node costs one traversal step plus a test for each primitive child
+	double area = inner->box.surface_area();
+	double cost = area;
+	cost += child_sah_cost(inner->left.get(), area, expansions);
+	if (inner->right != inner->left) cost += child_sah_cost(inner->right.get(), area, expansions);
+	return cost;
+}
+
+double bvh_node::sah_cost(double* expansions) const {
+	double area = box.surface_area();
+	if (area <= 0) return 0;
+	double added = 0;
+	double cost = subtree_sah_cost(this, &added) / area;
+	if (expansions) *expansions = added / area;
+	return cost;
+}
+
+inline void collect_stats(const hittable* node, int depth, bvh_stats& stats) {
+	if (auto lazy = dynamic_cast<const lazy_bvh_node*>(node)) {
+		if (lazy->built()) collect_stats(lazy->subtree(), depth, stats);
+		else stats.deferred++;
+		return;
+	}
+	auto inner = dynamic_cast<const bvh_node*>(node);
+	if (!inner) return;
+
+	stats.nodes++;
+	stats.max_depth = std::max(stats.max_depth, depth);
+	size_t primitives = 0;
+	const hittable* children[2] = { inner->left.get(), inner->right.get() };
+	for (int c = 0; c < (inner->right == inner->left ? 1 : 2); c++) {
+		if (dynamic_cast<const bvh_node*>(children[c]) || dynamic_cast<const lazy_bvh_node*>(children[c]))
+			collect_stats(children[c], depth + 1, stats);
+		else
+			primitives++;
+	}
+
+	if (inner->right != inner->left) {
+		aabb a, b;
+		inner->left->bounding_box(a);
+		inner->right->bounding_box(b);
+		Vec3f d;
+		bool disjoint = false;
+		for (int i = 0; i < 3; i++) {
+			d[i] = std::min(a.max()[i], b.max()[i]) - std::max(a.min()[i], b.min()[i]);
+			if (d[i] < 0) disjoint = true;
+		}
+		if (!disjoint) stats.overlap += 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	if (primitives > 0) {
+		stats.leaves++;
+		stats.primitives += primitives;
+		if (stats.depth_histogram.size() <= size_t(depth)) stats.depth_histogram.resize(depth + 1);
+		stats.depth_histogram[depth]++;
+		if (stats.leaf_histogram.size() <= primitives) stats.leaf_histogram.resize(primitives + 1);
+		stats.leaf_histogram[primitives]++;
+	}
+}
+
+bvh_stats bvh_node::stats() const {
+	bvh_stats result;
+	collect_stats(this, 0, result);
+	result.sah_cost = sah_cost();
+	double area = box.surface_area();
+	result.overlap = area > 0 ? result.overlap / area : 0;
+	return result;
+}
+
+void bvh_stats::print(std::ostream& out, const std::string& name) const {
+	out << "# bvh " << name << ": " << nodes << " nodes, " << leaves << " leaves, " << primitives << " primitive references, depth "
+		<< max_depth << ", sah " << sah_cost << ", overlap " << overlap;
+	if (deferred > 0) out << ", " << deferred << " lazy subtrees unbuilt";
+	out << "\n# leaves by depth:";
+	for (size_t d = 0; d < depth_histogram.size(); d++)
+		if (depth_histogram[d] > 0) out << " " << d << ":" << depth_histogram[d];
+	out << "\n# leaves by size:";
+	for (size_t n = 0; n < leaf_histogram.size(); n++)
+		if (leaf_histogram[n] > 0) out << " " << n << ":" << leaf_histogram[n];
+	out << std::endl;
+}
+
+// a reference is one primitive, or the part of it left after spatial splits, inside a node
+struct bvh_reference {
+	size_t index; // into the source object list
+	aabb box;
+};
+
+class spatial_bvh_builder {
+public:
+	spatial_bvh_builder(const std::vector<shared_ptr<hittable>>& src_objects, const bvh_build_options& opts);
+
+	void build_root(bvh_node& root);
+	size_t reference_count() const { return references; }
+
+private:
+	struct split {
+		double cost = infinity;
+		int axis = 0;
+		bool spatial = false;
+		double position = 0; // split plane, compared against centroids for object splits
+		aabb left_box, right_box;
+	};
+
+	shared_ptr<hittable> build(std::vector<bvh_reference>& refs, int depth);
+	split find_object_split(const std::vector<bvh_reference>& refs) const;
+	split find_spatial_split(const std::vector<bvh_reference>& refs, const aabb& node_box) const;
+	void partition_object(std::vector<bvh_reference>& refs, const split& s, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs) const;
+	void partition_spatial(std::vector<bvh_reference>& refs, const split& s, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs);
+	void partition_median(std::vector<bvh_reference>& refs, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs) const;
+	bool clip_reference(const bvh_reference& ref, int axis, double lo, double hi, aabb& output_box) const;
+
+	static const int bin_count = 16;
+	static const int max_depth = 64;
+
+	const std::vector<shared_ptr<hittable>>& objects;
+	bvh_build_options options;
+	double root_area;
+	long long duplicate_budget;
+	size_t references;
+};
+
+inline aabb reference_bounds(const std::vector<bvh_reference>& refs) {
+	aabb bounds = refs[0].box;
+	for (size_t i = 1; i < refs.size(); i++) bounds = surrounding_box(bounds, refs[i].box);
+	return bounds;
+}
+
+inline double box_centre(const aabb& b, int axis) {
+	return 0.5 * (b.min()[axis] + b.max()[axis]);
+}
+
+inline aabb merge_box(bool empty, const aabb& a, const aabb& b) {
+	return empty ? b : surrounding_box(a, b);
+}
+
+spatial_bvh_builder::spatial_bvh_builder(const std::vector<shared_ptr<hittable>>& src_objects, const bvh_build_options& opts)
+	: objects(src_objects), options(opts), root_area(0), references(0) {
+	duplicate_budget = static_cast<long long>(opts.max_duplication * src_objects.size());
+}
+
+void spatial_bvh_builder::build_root(bvh_node& root) {
+	std::vector<bvh_reference> refs;
+	refs.reserve(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		bvh_reference ref;
+		ref.index = i;
+		if (!objects[i]->bounding_box(ref.box)) {
+			std::cerr << "No bounding box in bvh constructor. \n";
+			continue;
+		}
+		refs.push_back(ref);
+	}
+	references = refs.size();
+	if (refs.empty()) return;
+	root_area = reference_bounds(refs).surface_area();
+
+	if (refs.size() == 1) {
+		root.left = root.right = objects[refs[0].index];
+		root.box = refs[0].box;
+		return;
+	}
+	auto node = std::static_pointer_cast<bvh_node>(build(refs, 0));
+	root.left = node->left;
+	root.right = node->right;
+	root.box = node->box;
+}
+
+shared_ptr<hittable> spatial_bvh_builder::build(std::vector<bvh_reference>& refs, int depth) {
+	if (refs.size() == 1) return objects[refs[0].index];
+
+	aabb node_box = reference_bounds(refs);
+	if (options.lazy && depth >= options.eager_depth && refs.size() > 2) {
+		//a node never holds two parts of the same primitive so the indices are already unique
+		std::vector<shared_ptr<hittable>> subset;
+		for (const auto& ref : refs) subset.push_back(objects[ref.index]);
+		auto node = make_shared<lazy_bvh_node>(subset, options);
+		node->box = node_box;
+		return node;
+	}
+	std::vector<bvh_reference> left_refs, right_refs;
+
+	split best = find_object_split(refs);
+	bool try_spatial = options.split_mode == bvh_split_mode::spatial && duplicate_budget > 0 && depth < max_depth;
+	if (try_spatial && best.cost < infinity) {
+		//overlap between the object split children is what spatial splits can remove
+		Point3f lo(fmax(best.left_box.min().x, best.right_box.min().x), fmax(best.left_box.min().y, best.right_box.min().y), fmax(best.left_box.min().z, best.right_box.min().z));
+		Point3f hi(fmin(best.left_box.max().x, best.right_box.max().x), fmin(best.left_box.max().y, best.right_box.max().y), fmin(best.left_box.max().z, best.right_box.max().z));
+		double overlap = (lo.x < hi.x && lo.y < hi.y && lo.z < hi.z) ? aabb(lo, hi).surface_area() : 0;
+		try_spatial = overlap > options.overlap_threshold * root_area;
+	}
+	if (try_spatial) {
+		split spatial = find_spatial_split(refs, node_box);
+		if (spatial.cost < best.cost) best = spatial;
+	}
+
+	if (best.cost == infinity) partition_median(refs, left_refs, right_refs);
+	else if (best.spatial) partition_spatial(refs, best, left_refs, right_refs);
+	else partition_object(refs, best, left_refs, right_refs);
+
+	//a split that fails to separate anything would recurse forever
+	if (left_refs.empty() || right_refs.empty()) {
+		left_refs.clear();
+		right_refs.clear();
+		partition_median(refs, left_refs, right_refs);
+	}
+
+	std::vector<bvh_reference>().swap(refs);
+	auto left = build(left_refs, depth + 1);
+	auto right = build(right_refs, depth + 1);
+	return make_shared<bvh_node>(left, right, node_box);
+}
+
+spatial_bvh_builder::split spatial_bvh_builder::find_object_split(const std::vector<bvh_reference>& refs) const {
+	split best;
+	//binned sah over the reference centroids
+	for (int axis = 0; axis < 3; axis++) {
+		double lo = infinity, hi = -infinity;
+		for (const auto& ref : refs) {
+			double c = box_centre(ref.box, axis);
+			lo = fmin(lo, c);
+			hi = fmax(hi, c);
+		}
+		if (hi - lo <= 0) continue;
+
+		int counts[bin_count] = {};
+		aabb boxes[bin_count];
+		double scale = bin_count / (hi - lo);
+		for (const auto& ref : refs) {
+			int b = std::min(bin_count - 1, static_cast<int>((box_centre(ref.box, axis) - lo) * scale));
+			boxes[b] = merge_box(counts[b] == 0, boxes[b], ref.box);
+			counts[b]++;
+		}
+
+		//sweep from the right to get the cost of everything past each plane
+		double right_area[bin_count];
+		int right_count[bin_count];
+		aabb right_boxes[bin_count];
+		aabb acc;
+		int n = 0;
+		for (int b = bin_count - 1; b > 0; b--) {
+			if (counts[b]) { acc = merge_box(n == 0, acc, boxes[b]); n += counts[b]; }
+			right_area[b] = n ? acc.surface_area() : 0;
+			right_count[b] = n;
+			right_boxes[b] = acc;
+		}
+		acc = aabb();
+		n = 0;
+		for (int b = 0; b < bin_count - 1; b++) {
+			if (counts[b]) { acc = merge_box(n == 0, acc, boxes[b]); n += counts[b]; }
+			if (n == 0 || right_count[b + 1] == 0) continue;
+			double cost = acc.surface_area() * n + right_area[b + 1] * right_count[b + 1];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = false;
+				best.position = lo + (b + 1) / scale;
+				best.left_box = acc;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+bool spatial_bvh_builder::clip_reference(const bvh_reference& ref, int axis, double lo, double hi, aabb& output_box) const {
+	Point3f small = ref.box.min(), big = ref.box.max();
+	small[axis] = fmax(small[axis], lo);
+	big[axis] = fmin(big[axis], hi);
+	if (small[axis] > big[axis]) return false;
+	return objects[ref.index]->clipped_bounding_box(aabb(small, big), output_box);
+}
+
+spatial_bvh_builder::split spatial_bvh_builder::find_spatial_split(const std::vector<bvh_reference>& refs, const aabb& node_box) const {
+	split best;
+	for (int axis = 0; axis < 3; axis++) {
+		double lo = node_box.min()[axis], hi = node_box.max()[axis];
+		if (hi - lo <= 0) continue;
+
+		int entry[bin_count] = {}, exit[bin_count] = {};
+		bool used[bin_count] = {};
+		aabb boxes[bin_count];
+		double width = (hi - lo) / bin_count;
+		auto bin_of = [&](double x) { return std::max(0, std::min(bin_count - 1, static_cast<int>((x - lo) / width))); };
+
+		//chop every reference into the bins it straddles
+		for (const auto& ref : refs) {
+			int first = bin_of(ref.box.min()[axis]);
+			int last = bin_of(ref.box.max()[axis]);
+			for (int b = first; b <= last; b++) {
+				aabb part;
+				if (first == last) part = ref.box;
+				else if (!clip_reference(ref, axis, lo + b * width, lo + (b + 1) * width, part)) continue;
+				boxes[b] = merge_box(!used[b], boxes[b], part);
+				used[b] = true;
+			}
+			entry[first]++;
+			exit[last]++;
+		}
+
+		double right_area[bin_count];
+		int right_count[bin_count];
+		aabb right_boxes[bin_count];
+		aabb acc;
+		bool any = false;
+		int n = 0;
+		for (int b = bin_count - 1; b > 0; b--) {
+			if (used[b]) { acc = merge_box(!any, acc, boxes[b]); any = true; }
+			n += exit[b];
+			right_area[b] = any ? acc.surface_area() : 0;
+			right_count[b] = n;
+			right_boxes[b] = acc;
+		}
+		acc = aabb();
+		any = false;
+		n = 0;
+		for (int b = 0; b < bin_count - 1; b++) {
+			if (used[b]) { acc = merge_box(!any, acc, boxes[b]); any = true; }
+			n += entry[b];
+			if (n == 0 || right_count[b + 1] == 0) continue;
+			double cost = acc.surface_area() * n + right_area[b + 1] * right_count[b + 1];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = true;
+				best.position = lo + (b + 1) * width;
+				best.left_box = acc;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+void spatial_bvh_builder::partition_object(std::vector<bvh_reference>& refs, const split& s, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs) const {
+	for (const auto& ref : refs) {
+		if (box_centre(ref.box, s.axis) < s.position) left_refs.push_back(ref);
+		else right_refs.push_back(ref);
+	}
+}
+
+void spatial_bvh_builder::partition_spatial(std::vector<bvh_reference>& refs, const split& s, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs) {
+	size_t before = refs.size();
+	for (const auto& ref : refs) {
+		if (ref.box.max()[s.axis] <= s.position) { left_refs.push_back(ref); continue; }
+		if (ref.box.min()[s.axis] >= s.position) { right_refs.push_back(ref); continue; }
+
+		//straddles the plane, keep whichever halves are non-empty after clipping
+		bvh_reference part = ref;
+		if (clip_reference(ref, s.axis, -infinity, s.position, part.box)) left_refs.push_back(part);
+		if (clip_reference(ref, s.axis, s.position, infinity, part.box)) right_refs.push_back(part);
+	}
+	long long added = static_cast<long long>(left_refs.size() + right_refs.size()) - static_cast<long long>(before);
+	duplicate_budget -= added;
+	references += added;
+}
+
+void spatial_bvh_builder::partition_median(std::vector<bvh_reference>& refs, std::vector<bvh_reference>& left_refs, std::vector<bvh_reference>& right_refs) const {
+	aabb bounds = reference_bounds(refs);
+	Vec3f extent = bounds.max() - bounds.min();
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+	std::sort(refs.begin(), refs.end(), [axis](const bvh_reference& a, const bvh_reference& b) {
+		return box_centre(a.box, axis) < box_centre(b.box, axis);
+		});
+	size_t mid = refs.size() / 2;
+	left_refs.assign(refs.begin(), refs.begin() + mid);
+	right_refs.assign(refs.begin() + mid, refs.end());
+}
+
+bvh_node::bvh_node(const hittable_list& list, const bvh_build_options& options) {
+	if (options.split_mode == bvh_split_mode::spatial) {
+		spatial_bvh_builder builder(list.objects, options);
+		builder.build_root(*this);
+		if (!options.lazy) std::cerr << "# sbvh references " << builder.reference_count() << " for " << list.objects.size() << " primitives" << std::endl;
+	}
+	else {
+		*this = bvh_node(list.objects, 0, list.objects.size(), options.lazy ? &options : nullptr);
+	}
+}
+
@@ -0,0 +1,109 @@
+#pragma once
+#include "common.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the state of a progressive render, so a long render can stop and carry on where it left off.
+// the file is a fixed 128 byte header, then width*height*3 floats of sample sums, then width*height
+// sample counts as uint32, all little endian and 4 byte aligned so it can be mapped straight into memory.
+// pass p of a render uses pass_seed(seed, p) for every pixel, so the seed and the passes done are all the
+// random state there is, and a resumed render comes out bit for bit like one that never stopped
+
+struct checkpoint_header {
+	char magic[8];       // "RTCKPT1"
+	uint32_t header_size; // sizeof(checkpoint_header), where the sums start
+	uint32_t version;
+	int32_t width, height;
+	int32_t spp;         // samples per pixel in each pass
+	int32_t max_depth;
+	uint64_t seed;
+	uint64_t passes;     // passes finished, the next one uses pass_seed(seed, passes)
+	char scene[32];
+	char reserved[48];
+};
+static_assert(sizeof(checkpoint_header) == 128, "the checkpoint header is part of the file format");
+static_assert(sizeof(Colour) == 3 * sizeof(float), "checkpoint sums are written as packed floats");
+
+inline checkpoint_header make_checkpoint_header(const std::string& scene, int width, int height, int spp, int max_depth, uint64_t seed, uint64_t passes) {
+	checkpoint_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RTCKPT1", 8);
+	header.header_size = sizeof(header);
+	//2 since passes were seeded with pass_seed instead of seed + p, a version 1 file would resume differently
+	header.version = 2;
+	header.width = width;
+	header.height = height;
+	header.spp = spp;
+	header.max_depth = max_depth;
+	header.seed = seed;
+	header.passes = passes;
+	scene.copy(header.scene, sizeof(header.scene) - 1);
+	return header;
+}
+
+// writes to filename.tmp then renames it over filename, so a node stopped part way through a write
+// still leaves the last complete checkpoint
+inline bool write_checkpoint(const std::string& filename, const checkpoint_header& header, const std::vector<Colour>& sums, const std::vector<uint32_t>& samples) {
+	std::string temporary = filename + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(Colour));
+		out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(uint32_t));
+		if (!out) return false;
+	}
+#ifdef _WIN32
+	//rename does not replace an existing file on windows
+	std::remove(filename.c_str());
+#endif
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+inline bool read_checkpoint(const std::string& filename, checkpoint_header& header, std::vector<Colour>& sums, std::vector<uint32_t>& samples) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+	if (memcmp(header.magic, "RTCKPT1", 8) != 0 || header.version != 2 || header.header_size != sizeof(header)) return false;
+	if (header.width < 1 || header.height < 1 || header.spp < 1) return false;
+	header.scene[sizeof(header.scene) - 1] = 0;
+	size_t pixels = size_t(header.width) * header.height;
+	sums.resize(pixels);
+	samples.resize(pixels);
+	return in.read(reinterpret_cast<char*>(sums.data()), pixels * sizeof(Colour))
+		&& in.read(reinterpret_cast<char*>(samples.data()), pixels * sizeof(uint32_t));
+}
+
+// writes checkpoints on a thread of its own so the render never waits for the disk
+class checkpoint_writer {
+public:
+	~checkpoint_writer() { wait(); }
+
+	// starts writing copies of the buffers in the background. if the last write has not finished this one
+	// is skipped and false returned, the next checkpoint will have everything anyway
+	bool write_async(const std::string& filename, const checkpoint_header& header, const std::vector<Colour>& sums, const std::vector<uint32_t>& samples) {
+		if (busy.load(std::memory_order_acquire)) return false;
+		wait();
+		busy.store(true, std::memory_order_release);
+		thread = std::thread([this, filename, header, sums, samples] {
+			if (!write_checkpoint(filename, header, sums, samples)) failed.store(true);
+			busy.store(false, std::memory_order_release);
+		});
+		return true;
+	}
+
+	// blocks until the write in flight, if any, is done. false if any write so far failed
+	bool wait() {
+		if (thread.joinable()) thread.join();
+		return !failed.load();
+	}
+
+private:
+	std::thread thread;
+	std::atomic<bool> busy{ false };
+	std::atomic<bool> failed{ false };
+};
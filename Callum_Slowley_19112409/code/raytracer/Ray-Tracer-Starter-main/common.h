@@ -4,6 +4,7 @@
 #include <limits>
 #include <memory>
 #include <cstdlib>
+#include "random.h"
 
 
 
@@ -30,7 +31,7 @@ inline double clamp(double x, double min, double max) {
 
 inline double random_double() {
 	//returns a radom real in [0,1]
-	return rand() / (RAND_MAX + 1.0);
+	return random_unit();
 }
 
 
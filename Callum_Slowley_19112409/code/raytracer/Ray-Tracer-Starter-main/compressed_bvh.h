@@ -0,0 +1,198 @@
+#pragma once
+#include "common.h"
+#include "hittable.h"
+#include "bvh.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// a bvh_node is a vtable pointer, two shared_ptrs and six floats, around 80 bytes once the
+// make_shared control block is counted, and every child is a separate heap allocation.
+// this flattens a built bvh into one array of 36 byte nodes where each node keeps its own box as a
+// float origin plus a power of two scale per axis, and the two child boxes as 8 bit offsets on that grid.
+// minimums are rounded down and maximums up so the decoded boxes always contain the real ones.
+// the layout is fixed once built, refit the bvh_node and compress again if the geometry moves.
+// it only pays off once the tree no longer fits in the cache. on the bundled meshes, whose trees are
+// a few hundred kilobytes at most, the extra decoding makes "bvh compressed hit" in the benchmark
+// slower than "bvh closest hit" or level with it, so it is left to bvh_build_options::compress
+struct compressed_bvh_node {
+	float origin[3];
+	int8_t exponent[3];
+	uint8_t leaf_mask; // bit i set when child i is a primitive
+	uint8_t lo[2][3];
+	uint8_t hi[2][3];
+	uint32_t child[2]; // node index, or primitive index for leaves
+};
+
+class compressed_bvh : public hittable {
+public:
+	compressed_bvh(const bvh_node& root);
+
+	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override {
+		return traverse<false>(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override {
+		hit_record rec;
+		return traverse<true>(r, t_min, t_max, rec);
+	}
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = box;
+		return true;
+	}
+
+	size_t memory_used() const { return nodes.size() * sizeof(compressed_bvh_node) + primitives.size() * sizeof(hittable*); }
+
+public:
+	std::vector<compressed_bvh_node> nodes;
+	std::vector<const hittable*> primitives;
+	aabb box;
+	int depth = 0; // levels below the root, the traversal stack never holds more than depth + 1 nodes
+
+private:
+	uint32_t flatten(const bvh_node& node, int level);
+	// closest hit, or with any_hit true back at the first primitive hit
+	template<bool any_hit>
+	bool traverse(const Ray& r, double t_min, double t_max, hit_record& rec) const;
+	std::vector<shared_ptr<hittable>> owned; // keeps the primitives alive
+};
+
+// 2^e for e in -126..127, built from the exponent bits. ldexpf is a library call and was most of the traversal
+inline float power_of_two(int e) {
+	uint32_t bits = uint32_t(e + 127) << 23;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+inline float dequantize(const compressed_bvh_node& node, int axis, int q) {
+	return node.origin[axis] + static_cast<float>(q) * power_of_two(node.exponent[axis]);
+}
+
+compressed_bvh::compressed_bvh(const bvh_node& root) {
+	box = root.box;
+	nodes.reserve(64);
+	flatten(root, 0);
+}
+
+uint32_t compressed_bvh::flatten(const bvh_node& node, int level) {
+	depth = std::max(depth, level);
+	uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(compressed_bvh_node());
+
+	compressed_bvh_node packed = {};
+	for (int a = 0; a < 3; a++) {
+		float lo = node.box.min()[a], hi = node.box.max()[a];
+		packed.origin[a] = lo;
+		//smallest power of two step that lets 255 steps reach the top of the box
+		int e = -126;
+		if (hi > lo) frexpf((hi - lo) / 255.0f, &e);
+		packed.exponent[a] = static_cast<int8_t>(std::max(-126, std::min(127, e)));
+		while (packed.exponent[a] < 127 && dequantize(packed, a, 255) < hi) packed.exponent[a]++;
+	}
+
+	const shared_ptr<hittable>* children[2] = { &node.left, &node.right };
+	int count = node.right == node.left ? 1 : 2;
+	for (int c = 0; c < 2; c++) {
+		const shared_ptr<hittable>& child = *children[c < count ? c : 0];
+		aabb child_box;
+		child->bounding_box(child_box);
+		for (int a = 0; a < 3; a++) {
+			float scale = power_of_two(packed.exponent[a]);
+			int qlo = static_cast<int>(floorf((child_box.min()[a] - packed.origin[a]) / scale));
+			int qhi = static_cast<int>(ceilf((child_box.max()[a] - packed.origin[a]) / scale));
+			qlo = std::max(0, std::min(255, qlo));
+			qhi = std::max(0, std::min(255, qhi));
+			//step outwards until the rounded decode really covers the child
+			while (qlo > 0 && dequantize(packed, a, qlo) > child_box.min()[a]) qlo--;
+			while (qhi < 255 && dequantize(packed, a, qhi) < child_box.max()[a]) qhi++;
+			packed.lo[c][a] = static_cast<uint8_t>(qlo);
+			packed.hi[c][a] = static_cast<uint8_t>(qhi);
+		}
+	}
+
+	for (int c = 0; c < 2; c++) {
+		const shared_ptr<hittable>& child = *children[c < count ? c : 0];
+		const hittable* target = child.get();
+		//deferred subtrees have to exist before they can be packed
+		if (auto lazy = dynamic_cast<const lazy_bvh_node*>(target)) target = lazy->subtree();
+
+		if (auto inner = dynamic_cast<const bvh_node*>(target)) {
+			packed.child[c] = flatten(*inner, level + 1);
+		}
+		else if (c < count) {
+			packed.leaf_mask |= 1 << c;
+			packed.child[c] = static_cast<uint32_t>(primitives.size());
+			primitives.push_back(target);
+			owned.push_back(child);
+		}
+		else {
+			//single primitive node, repeat the first child so both slots are valid
+			packed.leaf_mask |= 1 << c;
+			packed.child[c] = packed.child[0];
+		}
+	}
+	nodes[index] = packed;
+	return index;
+}
+
+template<bool any_hit>
+bool compressed_bvh::traverse(const Ray& r, double t_min, double t_max, hit_record& rec) const {
+	if (nodes.empty() || !box.hit(r, t_min, t_max)) return false;
+
+	const Point3f& origin = r.origin();
+	const Vec3f& inv_dir = r.inv_direction();
+
+	render_counters& stats = counters();
+	//on the real stack unless the tree is deeper than any the builds here make
+	const int local_size = 128;
+	uint32_t local[local_size];
+	std::vector<uint32_t> deep;
+	uint32_t* stack = local;
+	if (depth + 2 > local_size) {
+		deep.resize(depth + 2);
+		stack = deep.data();
+	}
+	int top = 0;
+	stack[top++] = 0;
+	bool hit_anything = false;
+	double closest = t_max;
+
+	while (top > 0) {
+		const compressed_bvh_node& node = nodes[stack[--top]];
+		stats.node_visits++;
+		stats.box_tests += 2;
+		float entry[2];
+		bool visit[2];
+		for (int c = 0; c < 2; c++) {
+			float t0 = static_cast<float>(t_min), t1 = static_cast<float>(closest);
+			for (int a = 0; a < 3; a++) {
+				float near_t = (dequantize(node, a, node.lo[c][a]) - origin[a]) * inv_dir[a];
+				float far_t = (dequantize(node, a, node.hi[c][a]) - origin[a]) * inv_dir[a];
+				if (inv_dir[a] < 0) std::swap(near_t, far_t);
+				t0 = near_t > t0 ? near_t : t0;
+				t1 = far_t < t1 ? far_t : t1;
+			}
+			visit[c] = t0 <= t1;
+			entry[c] = t0;
+		}
+		if (node.child[0] == node.child[1] && node.leaf_mask == 3) visit[1] = false;
+
+		//push the far child first so the near one is popped next and shrinks closest early
+		int first = (visit[1] && (!visit[0] || entry[1] < entry[0])) ? 1 : 0;
+		for (int k = 1; k >= 0; k--) {
+			int c = k == 0 ? first : 1 - first;
+			if (visit[c] && !(node.leaf_mask & (1 << c))) stack[top++] = node.child[c];
+		}
+		//primitive children are tested straight away, nearest first
+		for (int k = 0; k < 2; k++) {
+			int c = k == 0 ? first : 1 - first;
+			if (!visit[c] || !(node.leaf_mask & (1 << c))) continue;
+			if (primitives[node.child[c]]->hit(r, t_min, closest, rec)) {
+				if (any_hit) return true;
+				hit_anything = true;
+				closest = rec.t;
+			}
+		}
+	}
+	return hit_anything;
+}
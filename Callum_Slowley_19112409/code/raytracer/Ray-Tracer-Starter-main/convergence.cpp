@@ -0,0 +1,187 @@
+// Error against time for different ways of rendering the same scene. a reference is rendered once at a
+// high sample count and kept in a .pfm file, then each candidate adds one sample per pixel at a time and
+// its RMSE, relative MSE and SSIM to the reference are recorded each time the clock passes a budget.
+// faster frames only help if the error falls faster too, so sampler and integrator changes should be
+// judged on these curves. see README.md for the build command.
+//
+// usage: convergence [--scene name] [--width N] [--height N] [--reference-spp N] [--budget seconds]
+//                    [--threads N] [--filter text] [--out file.csv]
+
+#include "common.h"
+#include "scenes.h"
+#include "render.h"
+#include "wavefront.h"
+#include "image_metrics.h"
+#include "denoise.h"
+#include "rtw_stb_image.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// add new samplers or integrators here to compare them against the ones there are
+struct candidate {
+	const char* name;
+	bool wavefront;
+	bool sort_rays;
+	int max_depth;
+	bool denoised; // measured after denoise.h, the filter's time counted in the checkpoint's seconds
+};
+
+static const candidate candidates[] = {
+	{ "classic", false, false, 50, false },
+	{ "classic_depth8", false, false, 8, false },
+	{ "classic_denoised", false, false, 50, true },
+	{ "wavefront", true, false, 50, false },
+	{ "wavefront_sorted", true, true, 50, false },
+};
+
+struct convergence_options {
+	std::string scene = "test";
+	int width = 160;
+	int height = 90;
+	int reference_spp = 1024;
+	double budget = 8;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string filter;
+	std::string out = "convergence.csv";
+};
+
+// a render_pixel sum as linear colour, 1 for full white
+static void to_linear(const std::vector<Colour>& sums, int spp, std::vector<Colour>& linear) {
+	linear.resize(sums.size());
+	for (size_t i = 0; i < sums.size(); i++) linear[i] = sums[i] / (255.f * spp);
+}
+
+static void load_reference(const convergence_options& options, const scene_setup& setup, std::vector<Colour>& reference) {
+	std::string filename = "convergence_" + options.scene + "_" + std::to_string(options.width) + "x" + std::to_string(options.height)
+		+ "_" + std::to_string(options.reference_spp) + ".pfm";
+	int width = 0, height = 0;
+	if (read_pfm(filename, reference, width, height) && width == options.width && height == options.height) {
+		std::cerr << "# reference from " << filename << std::endl;
+		return;
+	}
+
+	std::cerr << "# rendering the reference at " << options.reference_spp << " spp, this only happens once" << std::endl;
+	render_settings settings;
+	settings.width = options.width;
+	settings.height = options.height;
+	settings.spp = options.reference_spp;
+	settings.threads = options.threads;
+	//far away from the seeds the candidates use, so its noise is not correlated with theirs
+	settings.seed = 1u << 30;
+	std::vector<Colour> sums;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	render_image(setup.world, setup.make_camera(double(options.width) / options.height), settings, sums);
+	std::cerr << "# reference took " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count() << " s" << std::endl;
+	to_linear(sums, options.reference_spp, reference);
+	if (!write_pfm(filename, reference, options.width, options.height)) std::cerr << "# could not write " << filename << std::endl;
+}
+
+// one sample per pixel per pass until the budget is spent, measuring the error at budget/2^k
+static void run_candidate(const candidate& c, const convergence_options& options, const scene_setup& setup,
+	const std::vector<Colour>& reference, std::ofstream& csv) {
+	typedef std::chrono::high_resolution_clock clock;
+	camera cam = setup.make_camera(double(options.width) / options.height);
+	wavefront_renderer stages(options.width, options.height, 1, c.max_depth);
+	stages.threads = options.threads;
+	stages.sort_secondary = c.sort_rays;
+
+	render_settings settings;
+	settings.width = options.width;
+	settings.height = options.height;
+	settings.spp = 1;
+	settings.max_depth = c.max_depth;
+	settings.threads = options.threads;
+
+	double checkpoint = options.budget / 64;
+	double elapsed = 0;
+	ThreadPool pool(static_cast<short>(options.threads));
+	feature_buffers features;
+	if (c.denoised) {
+		auto t0 = clock::now();
+		features.render(setup.world, cam, options.width, options.height, pool);
+		elapsed += std::chrono::duration<double>(clock::now() - t0).count();
+	}
+	std::vector<Colour> sums(size_t(options.width) * options.height, Colour(0, 0, 0));
+	std::vector<Colour> pass, linear;
+	for (int spp = 1; elapsed < options.budget; spp++) {
+		//only the rendering is timed, not the error measures
+		auto t0 = clock::now();
+		if (c.wavefront) {
+			stages.seed = spp;
+			stages.render(setup.world, cam, pass);
+		}
+		else {
+			settings.seed = spp;
+			render_image(setup.world, cam, settings, pass);
+		}
+		for (size_t i = 0; i < sums.size(); i++) sums[i] = sums[i] + pass[i];
+		elapsed += std::chrono::duration<double>(clock::now() - t0).count();
+
+		if (elapsed < checkpoint && elapsed < options.budget) continue;
+		while (checkpoint <= elapsed) checkpoint *= 2;
+		double seconds = elapsed;
+		if (c.denoised) {
+			//the filter runs on the mean, once for each checkpoint rather than every pass
+			auto t_filter = clock::now();
+			std::vector<Colour> mean(sums.size());
+			for (size_t i = 0; i < sums.size(); i++) mean[i] = sums[i] / float(spp);
+			denoise(mean, features, denoise_settings(), float(spp), pool, mean);
+			seconds += std::chrono::duration<double>(clock::now() - t_filter).count();
+			to_linear(mean, 1, linear);
+		}
+		else {
+			to_linear(sums, spp, linear);
+		}
+		double rmse = root_mean_squared_error(linear, reference);
+		double relmse = relative_mean_squared_error(linear, reference);
+		double ssim = structural_similarity(linear, reference, options.width, options.height);
+		printf("%-20s %6d spp %9.3f s  rmse %.5f  relmse %.5f  ssim %.4f\n", c.name, spp, seconds, rmse, relmse, ssim);
+		csv << options.scene << "," << c.name << "," << spp << "," << seconds << "," << rmse << "," << relmse << "," << ssim << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	convergence_options options;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (strcmp(argv[i], "--scene") == 0 && more) options.scene = argv[++i];
+		else if (strcmp(argv[i], "--width") == 0 && more) options.width = std::max(8, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--height") == 0 && more) options.height = std::max(8, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--reference-spp") == 0 && more) options.reference_spp = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--budget") == 0 && more) options.budget = std::max(0.01, atof(argv[++i]));
+		else if (strcmp(argv[i], "--threads") == 0 && more) options.threads = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--filter") == 0 && more) options.filter = argv[++i];
+		else if (strcmp(argv[i], "--out") == 0 && more) options.out = argv[++i];
+		else {
+			std::cerr << "unknown argument " << argv[i] << std::endl;
+			return 2;
+		}
+	}
+
+	//the bvh builds pick split axes at random, the same trees every run keep the runs comparable
+	seed_random(1);
+	scene_setup setup;
+	if (!make_scene(options.scene, setup)) {
+		std::cerr << "no scene called " << options.scene << ", try";
+		for (const char* name : scene_names) std::cerr << " " << name;
+		std::cerr << std::endl;
+		return 2;
+	}
+	animate_scene(setup.world, 0);
+
+	std::vector<Colour> reference;
+	load_reference(options, setup, reference);
+
+	std::ofstream csv(options.out);
+	csv << "scene,candidate,spp,seconds,rmse,relmse,ssim" << std::endl;
+	for (const candidate& c : candidates) {
+		if (!options.filter.empty() && std::string(c.name).find(options.filter) == std::string::npos) continue;
+		run_candidate(c, options, setup, reference, csv);
+	}
+	return 0;
+}
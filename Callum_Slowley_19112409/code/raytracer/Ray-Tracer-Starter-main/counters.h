@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <vector>
+
+// work done while rendering, counted per thread so the hot paths only bump a plain integer in
+// memory no other thread writes. render_counter_registry::collect() sums them once a frame is done.
+// each block starts a cache line and fills whole lines, so two threads' counts never share one
+struct alignas(64) render_counters {
+	uint64_t primary_rays = 0;
+	uint64_t secondary_rays = 0;
+	uint64_t shadow_rays = 0;
+	uint64_t node_visits = 0;
+	uint64_t box_tests = 0;
+	uint64_t triangle_tests = 0;
+	uint64_t texture_lookups = 0;
+	uint64_t scatters[5] = {}; // by material_type
+
+	void add(const render_counters& other);
+	bool empty() const;
+	// one json object, no newline
+	void write_json(std::ostream& out) const;
+};
+static_assert(sizeof(render_counters) % 64 == 0, "render_counters must fill whole cache lines");
+
+class render_counter_registry {
+public:
+	static render_counter_registry& instance() {
+		static render_counter_registry registry;
+		return registry;
+	}
+
+	// a block for a new thread, reusing one a finished thread gave back. counts are kept until collected
+	render_counters* acquire();
+	void release(render_counters* block);
+	// per thread counts since the last collect, then zeroes them. call between frames, not while rendering
+	std::vector<render_counters> collect();
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<char[]>> storage; // new only aligns to 16 bytes before c++17, so blocks are placed in here by hand
+	std::vector<render_counters*> blocks;
+	std::vector<render_counters*> spare;
+};
+
+// one json line for a frame: totals, rays per second and the counts of each thread
+void write_frame_json(std::ostream& out, int frame, double render_ms, const std::vector<render_counters>& threads);
+
+// counters of the calling thread
+inline render_counters& counters() {
+	struct slot {
+		render_counters* block;
+		slot() : block(render_counter_registry::instance().acquire()) {}
+		~slot() { render_counter_registry::instance().release(block); }
+	};
+	thread_local slot current;
+	return *current.block;
+}
+
+void render_counters::add(const render_counters& other) {
+	primary_rays += other.primary_rays;
+	secondary_rays += other.secondary_rays;
+	shadow_rays += other.shadow_rays;
+	node_visits += other.node_visits;
+	box_tests += other.box_tests;
+	triangle_tests += other.triangle_tests;
+	texture_lookups += other.texture_lookups;
+	for (int i = 0; i < 5; i++) scatters[i] += other.scatters[i];
+}
+
+bool render_counters::empty() const {
+	return primary_rays + secondary_rays + shadow_rays + node_visits + box_tests + triangle_tests + texture_lookups == 0;
+}
+
+void render_counters::write_json(std::ostream& out) const {
+	static const char* material_names[5] = { "lambertian", "metal", "dielectric", "water", "diffuse_light" };
+	out << "{\"primary_rays\":" << primary_rays << ",\"secondary_rays\":" << secondary_rays << ",\"shadow_rays\":" << shadow_rays
+		<< ",\"node_visits\":" << node_visits << ",\"box_tests\":" << box_tests << ",\"triangle_tests\":" << triangle_tests
+		<< ",\"texture_lookups\":" << texture_lookups << ",\"scatters\":{";
+	for (int i = 0; i < 5; i++) out << (i ? "," : "") << "\"" << material_names[i] << "\":" << scatters[i];
+	out << "}}";
+}
+
+void write_frame_json(std::ostream& out, int frame, double render_ms, const std::vector<render_counters>& threads) {
+	render_counters total;
+	for (const auto& t : threads) total.add(t);
+	double rays = static_cast<double>(total.primary_rays + total.secondary_rays + total.shadow_rays);
+	out << "{\"frame\":" << frame << ",\"render_ms\":" << render_ms
+		<< ",\"rays_per_second\":" << (render_ms > 0 ? rays * 1000.0 / render_ms : 0.0) << ",\"total\":";
+	total.write_json(out);
+	out << ",\"threads\":[";
+	for (size_t i = 0; i < threads.size(); i++) {
+		if (i) out << ",";
+		threads[i].write_json(out);
+	}
+	out << "]}" << std::endl;
+}
+
+render_counters* render_counter_registry::acquire() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!spare.empty()) {
+		render_counters* block = spare.back();
+		spare.pop_back();
+		return block;
+	}
+	size_t space = sizeof(render_counters) + alignof(render_counters);
+	storage.emplace_back(new char[space]);
+	void* line = storage.back().get();
+	std::align(alignof(render_counters), sizeof(render_counters), line, space);
+	blocks.push_back(new (line) render_counters());
+	return blocks.back();
+}
+
+void render_counter_registry::release(render_counters* block) {
+	std::lock_guard<std::mutex> lock(mutex);
+	spare.push_back(block);
+}
+
+std::vector<render_counters> render_counter_registry::collect() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<render_counters> result;
+	for (render_counters* block : blocks) {
+		if (!block->empty()) result.push_back(*block);
+		*block = render_counters();
+	}
+	return result;
+}
@@ -0,0 +1,268 @@
+#pragma once
+#include "common.h"
+#include "scenes.h"
+#include "render.h"
+#include "counters.h"
+#include "image_metrics.h"
+#include "Multithreading.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// keeps one scene loaded and renders jobs sent to it over a unix domain socket, so a turntable or a
+// camera sweep pays for the obj parsing, texture decoding and bvh builds once instead of every frame.
+//
+// a client connects, sends one line of key=value pairs and gets one json line back when the image is
+// written, e.g. with socat:
+//   echo "output=frame1.tga width=640 height=360 spp=32 lookfrom=31,40,29 lookat=0,25,8" | socat - UNIX-CONNECT:raytracer.sock
+// keys: output (required, .tga or .pfm), width, height, spp, depth, seed, lookfrom, lookat, vfov,
+// aperture and time (seconds into the water animation). a line of just "quit" stops the daemon
+// once the queued jobs are done. jobs run one after another, each one on every thread of the pool.
+// a client gets request_timeout_seconds to send its line, so one that connects and says nothing can not
+// hold up the others, and jobs bigger than max_pixels or max_spp are turned away
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+class render_daemon {
+public:
+	render_daemon(scene_setup& scene, int threads) : setup(scene), pool(static_cast<short>(std::max(1, threads))) {}
+
+	// listens on socket_path until a quit job, returns the exit code
+	int serve(const std::string& socket_path);
+
+	int request_timeout_seconds = 2;
+	long long max_pixels = 7680LL * 4320; // 8k
+	int max_spp = 1 << 16;
+
+private:
+	typedef std::chrono::high_resolution_clock clock;
+
+	struct job {
+		int client;
+		clock::time_point received;
+		render_settings settings;
+		Point3f lookfrom, lookat;
+		double vfov, aperture;
+		float time;
+		std::string output;
+	};
+
+	// false with a message in error for a line that is not a job
+	bool parse_job(const std::string& line, job& j, std::string& error) const;
+	void run(job& j);
+	void run_queue();
+
+	scene_setup& setup;
+	ThreadPool pool;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<job> jobs;
+	bool stopping = false;
+};
+
+// one line from the client, at most 4kb
+inline std::string read_request(int client) {
+	std::string line;
+	char c;
+	while (line.size() < 4096 && read(client, &c, 1) == 1 && c != '\n') line += c;
+	if (!line.empty() && line.back() == '\r') line.pop_back();
+	return line;
+}
+
+inline void send_reply(int client, const std::string& reply) {
+	std::string line = reply + "\n";
+	size_t sent = 0;
+	while (sent < line.size()) {
+		ssize_t n = write(client, line.data() + sent, line.size() - sent);
+		if (n <= 0) break;
+		sent += size_t(n);
+	}
+	close(client);
+}
+
+// json string with quotes and backslashes escaped
+inline std::string json_string(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') out += '\\';
+		out += c;
+	}
+	return out + "\"";
+}
+
+inline bool parse_point(const std::string& text, Point3f& p) {
+	char c1, c2;
+	std::istringstream in(text);
+	return (in >> p.x >> c1 >> p.y >> c2 >> p.z) && c1 == ',' && c2 == ',';
+}
+
+bool render_daemon::parse_job(const std::string& line, job& j, std::string& error) const {
+	j.settings = render_settings();
+	j.settings.width = 1920;
+	j.settings.height = 1080;
+	j.settings.spp = 10;
+	j.lookfrom = setup.lookfrom;
+	j.lookat = setup.lookat;
+	j.vfov = setup.vfov;
+	j.aperture = setup.aperture;
+	j.time = 0;
+	j.output.clear();
+
+	std::istringstream words(line);
+	std::string word;
+	while (words >> word) {
+		size_t eq = word.find('=');
+		if (eq == std::string::npos) {
+			error = "expected key=value, got " + word;
+			return false;
+		}
+		std::string key = word.substr(0, eq), value = word.substr(eq + 1);
+		bool ok = true;
+		if (key == "output") j.output = value;
+		else if (key == "width") j.settings.width = atoi(value.c_str());
+		else if (key == "height") j.settings.height = atoi(value.c_str());
+		else if (key == "spp") j.settings.spp = atoi(value.c_str());
+		else if (key == "depth") j.settings.max_depth = atoi(value.c_str());
+		else if (key == "seed") j.settings.seed = strtoull(value.c_str(), nullptr, 10);
+		else if (key == "vfov") j.vfov = atof(value.c_str());
+		else if (key == "aperture") j.aperture = atof(value.c_str());
+		else if (key == "time") j.time = static_cast<float>(atof(value.c_str()));
+		else if (key == "lookfrom") ok = parse_point(value, j.lookfrom);
+		else if (key == "lookat") ok = parse_point(value, j.lookat);
+		else {
+			error = "unknown key " + key;
+			return false;
+		}
+		if (!ok) {
+			error = key + " wants x,y,z";
+			return false;
+		}
+	}
+	if (j.output.empty()) error = "no output";
+	else if (j.settings.width < 2 || j.settings.height < 2 || j.settings.spp < 1 || j.settings.max_depth < 1) error = "width and height must be at least 2, spp and depth at least 1";
+	else if (static_cast<long long>(j.settings.width) * j.settings.height > max_pixels) error = "width times height must be at most " + std::to_string(max_pixels);
+	else if (j.settings.spp > max_spp) error = "spp must be at most " + std::to_string(max_spp);
+	else if (j.vfov <= 0 || j.vfov >= 180) error = "vfov must be between 0 and 180";
+	return error.empty();
+}
+
+void render_daemon::run(job& j) {
+	auto t0 = clock::now();
+	double queue_ms = std::chrono::duration<double, std::milli>(t0 - j.received).count();
+
+	//the scene is shared by every job, only the water moves
+	if (!setup.world.animated.empty()) animate_scene(setup.world, j.time);
+	camera cam(j.lookfrom, j.lookat, Vec3f(0, 1, 0), j.vfov, double(j.settings.width) / j.settings.height, j.aperture, (j.lookfrom - j.lookat).length());
+	std::vector<Colour> sums;
+	render_counter_registry::instance().collect();
+	render_image(setup.world, cam, j.settings, sums, pool);
+	auto t1 = clock::now();
+
+	bool written;
+	const std::string& out = j.output;
+	if (out.size() > 4 && out.compare(out.size() - 4, 4, ".pfm") == 0) {
+		for (Colour& c : sums) c = c / (255.f * j.settings.spp);
+		written = write_pfm(out, sums, j.settings.width, j.settings.height);
+	}
+	else {
+		written = to_image(sums, j.settings.width, j.settings.height, j.settings.spp).write_tga_file(out.c_str());
+	}
+	auto t2 = clock::now();
+
+	render_counters total;
+	for (const auto& t : render_counter_registry::instance().collect()) total.add(t);
+	double render_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	double write_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	double rays = static_cast<double>(total.primary_rays + total.secondary_rays + total.shadow_rays);
+
+	std::ostringstream reply;
+	if (!written) reply << "{\"status\":\"error\",\"message\":" << json_string("could not write " + out) << "}";
+	else reply << "{\"status\":\"ok\",\"output\":" << json_string(out) << ",\"queue_ms\":" << queue_ms << ",\"render_ms\":" << render_ms
+		<< ",\"write_ms\":" << write_ms << ",\"rays_per_second\":" << (render_ms > 0 ? rays * 1000.0 / render_ms : 0.0) << "}";
+	std::cerr << "# " << reply.str() << std::endl;
+	send_reply(j.client, reply.str());
+}
+
+void render_daemon::run_queue() {
+	while (true) {
+		job j;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty()) return;
+			j = jobs.front();
+			jobs.pop_front();
+		}
+		run(j);
+	}
+}
+
+int render_daemon::serve(const std::string& socket_path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "socket path too long: " << socket_path << std::endl;
+		return 1;
+	}
+	socket_path.copy(address.sun_path, socket_path.size());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path.c_str());
+	if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		std::cerr << "could not listen on " << socket_path << std::endl;
+		if (listener >= 0) close(listener);
+		return 1;
+	}
+	//a client that hangs up before its reply must not take the daemon down with it
+	signal(SIGPIPE, SIG_IGN);
+	std::cerr << "Listening on " << socket_path << std::endl;
+
+	std::thread runner(&render_daemon::run_queue, this);
+	while (true) {
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0) continue;
+		//reads give up after the timeout and the partial line is answered as a bad job
+		timeval timeout = {};
+		timeout.tv_sec = request_timeout_seconds;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string line = read_request(client);
+		if (line == "quit") {
+			send_reply(client, "{\"status\":\"ok\",\"message\":\"stopping after the queued jobs\"}");
+			break;
+		}
+
+		job j;
+		std::string error;
+		if (!parse_job(line, j, error)) {
+			send_reply(client, "{\"status\":\"error\",\"message\":" + json_string(error) + "}");
+			continue;
+		}
+		j.client = client;
+		j.received = clock::now();
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(j);
+		queued.notify_one();
+	}
+
+	close(listener);
+	unlink(socket_path.c_str());
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queued.notify_one();
+	runner.join();
+	return 0;
+}
+#endif
@@ -0,0 +1,219 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include "Multithreading.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DENOISE_SSE
+#include <xmmintrin.h>
+#endif
+
+// cleans up a low spp render with the edge avoiding a-trous wavelet filter (Dammertz et al. 2010).
+// every pass blurs with a 5x5 b-spline whose taps are spread 1, 2, 4, 8... pixels apart, and each tap is
+// weighted down where the surface under it differs from the pixel's own: another normal, another depth or
+// a very different colour. the colour is divided by the albedo first and multiplied back after, so
+// textures stay sharp while the lighting on them is smoothed
+
+// what the middle ray of every pixel first hits, the guides for the filter
+struct feature_buffers {
+	int width = 0, height = 0;
+	std::vector<Colour> albedo; // 0 to 1, white for the sky, glass, water and lights
+	std::vector<Vec3f> normal;  // unit length, 0 for the sky
+	std::vector<float> depth;   // distance to the hit, 0 for the sky
+
+	// fills the buffers for a width by height image of cam
+	void render(const scene& world, const camera& cam, int w, int h, ThreadPool& pool);
+	// writes <prefix>_albedo.tga, _normal.tga and _depth.tga, the right way up like to_image
+	bool write(const std::string& prefix) const;
+};
+
+struct denoise_settings {
+	int iterations = 4;          // the last pass reaches 2 * 2^(iterations-1) pixels out
+	float sigma_colour = 2.0f;   // colour difference at 1 spp, 1 being white. over 1/sqrt(spp) and halved every pass
+	float normal_power = 64;     // weight is dot(n, n') to this power
+	float sigma_depth = 0.02f;   // depth difference relative to the depth, per pixel of tap spacing
+};
+
+// image is one mean per pixel, as render_pixel sums of one sample, over spp samples. the result goes in out
+// which may be image. the noise falls as more samples go into the means, so does the blur across colours
+void denoise(const std::vector<Colour>& image, const feature_buffers& features, const denoise_settings& settings, float spp,
+	ThreadPool& pool, std::vector<Colour>& out);
+
+// fn(y) for every row, shared out over pool, back once they are all done
+template<typename F>
+void for_each_row(ThreadPool& pool, int height, F fn) {
+	std::mutex mutex;
+	std::condition_variable finished;
+	int rows_left = height;
+	for (int y = 0; y < height; y++) {
+		pool.Enqueue([&, y] {
+			fn(y);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--rows_left == 0) finished.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&rows_left] { return rows_left == 0; });
+}
+
+void feature_buffers::render(const scene& world, const camera& cam, int w, int h, ThreadPool& pool) {
+	width = w;
+	height = h;
+	albedo.assign(size_t(w) * h, Colour(1, 1, 1));
+	normal.assign(albedo.size(), Vec3f(0, 0, 0));
+	depth.assign(albedo.size(), 0.0f);
+	for_each_row(pool, h, [&](int y) {
+		//the lens offset is random, seeded per row so the same frame always gets the same guides
+		seed_random(uint64_t(y) + 1);
+		for (int x = 0; x < w; x++) {
+			size_t i = size_t(y) * w + x;
+			Ray r = cam.get_ray((x + 0.5) / (w - 1), (y + 0.5) / (h - 1));
+			hit_record rec;
+			if (!world.hit(r, 0.001, infinity, rec)) continue;
+			rec.finalize(r);
+			albedo[i] = world.materials.albedo(rec.mat_id, rec);
+			Vec3f n = rec.normal;
+			normal[i] = n.normalize();
+			depth[i] = static_cast<float>(rec.t * r.direction().length());
+		}
+	});
+}
+
+bool feature_buffers::write(const std::string& prefix) const {
+	float far_depth = 0;
+	for (float d : depth) far_depth = std::max(far_depth, d);
+	TGAImage a(width, height, TGAImage::RGB), n(width, height, TGAImage::RGB), z(width, height, TGAImage::RGB);
+	auto byte = [](float v) { return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, v * 255.0f))); };
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t i = size_t(y) * width + x;
+			const Colour& c = albedo[i];
+			a.set(x, y, TGAColor(byte(sqrt(c.x)), byte(sqrt(c.y)), byte(sqrt(c.z)), 255));
+			const Vec3f& v = normal[i];
+			n.set(x, y, TGAColor(byte(0.5f + 0.5f * v.x), byte(0.5f + 0.5f * v.y), byte(0.5f + 0.5f * v.z), 255));
+			//near is bright, the sky black
+			unsigned char g = depth[i] > 0 ? byte(1.0f - depth[i] / (far_depth * 1.01f)) : 0;
+			z.set(x, y, TGAColor(g, g, g, 255));
+		}
+	}
+	bool ok = true;
+	for (auto* image : { &a, &n, &z }) image->flip_vertically();
+	ok = a.write_tga_file((prefix + "_albedo.tga").c_str()) && ok;
+	ok = n.write_tga_file((prefix + "_normal.tga").c_str()) && ok;
+	ok = z.write_tga_file((prefix + "_depth.tga").c_str()) && ok;
+	return ok;
+}
+
+// four floats so a colour or a normal is one sse register, the last one unused
+struct denoise_texel {
+	float v[4];
+};
+
+#ifdef DENOISE_SSE
+inline float dot3(const denoise_texel& a, const denoise_texel& b) {
+	__m128 m = _mm_mul_ps(_mm_loadu_ps(a.v), _mm_loadu_ps(b.v));
+	m = _mm_add_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(m);
+}
+inline float distance_squared(const denoise_texel& a, const denoise_texel& b) {
+	__m128 d = _mm_sub_ps(_mm_loadu_ps(a.v), _mm_loadu_ps(b.v));
+	d = _mm_mul_ps(d, d);
+	d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+	d = _mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(d);
+}
+#else
+inline float dot3(const denoise_texel& a, const denoise_texel& b) {
+	return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+}
+inline float distance_squared(const denoise_texel& a, const denoise_texel& b) {
+	float x = a.v[0] - b.v[0], y = a.v[1] - b.v[1], z = a.v[2] - b.v[2];
+	return x * x + y * y + z * z;
+}
+#endif
+
+void denoise(const std::vector<Colour>& image, const feature_buffers& features, const denoise_settings& settings, float spp,
+	ThreadPool& pool, std::vector<Colour>& out) {
+	const int w = features.width, h = features.height;
+	const size_t n = size_t(w) * h;
+	//keeps the albedo away from 0 so dividing by it and multiplying back is always the same
+	const float albedo_floor = 0.01f;
+	std::vector<denoise_texel> src(n), dst(n), normals(n);
+	for (size_t i = 0; i < n; i++) {
+		const Colour& a = features.albedo[i];
+		const Colour& c = image[i];
+		src[i] = { { c.x / (255.0f * (a.x + albedo_floor)), c.y / (255.0f * (a.y + albedo_floor)), c.z / (255.0f * (a.z + albedo_floor)), 0.0f } };
+		normals[i] = { { features.normal[i].x, features.normal[i].y, features.normal[i].z, 0.0f } };
+	}
+
+	static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	for (int pass = 0; pass < settings.iterations; pass++) {
+		const int step = 1 << pass;
+		const float sigma = settings.sigma_colour / (std::sqrt(std::max(1.0f, spp)) * step);
+		const float inv_colour = 1.0f / (sigma * sigma);
+		for_each_row(pool, h, [&](int y) {
+			for (int x = 0; x < w; x++) {
+				const size_t p = size_t(y) * w + x;
+				const float zp = features.depth[p];
+				const float inv_depth = zp > 0 ? 1.0f / (settings.sigma_depth * zp * step) : 0.0f;
+#ifdef DENOISE_SSE
+				__m128 sum = _mm_setzero_ps();
+#else
+				float sum[3] = { 0, 0, 0 };
+#endif
+				float weights = 0;
+				for (int ky = -2; ky <= 2; ky++) {
+					const int qy = y + ky * step;
+					if (qy < 0 || qy >= h) continue;
+					for (int kx = -2; kx <= 2; kx++) {
+						const int qx = x + kx * step;
+						if (qx < 0 || qx >= w) continue;
+						const size_t q = size_t(qy) * w + qx;
+						const float zq = features.depth[q];
+						//the sky only blurs with the sky
+						if ((zp > 0) != (zq > 0)) continue;
+						float exponent = distance_squared(src[p], src[q]) * inv_colour;
+						float weight = kernel[ky + 2] * kernel[kx + 2];
+						if (zp > 0) {
+							exponent += std::abs(zp - zq) * inv_depth;
+							weight *= std::pow(std::max(0.0f, dot3(normals[p], normals[q])), settings.normal_power);
+						}
+						weight *= std::exp(-exponent);
+#ifdef DENOISE_SSE
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src[q].v), _mm_set1_ps(weight)));
+#else
+						for (int k = 0; k < 3; k++) sum[k] += src[q].v[k] * weight;
+#endif
+						weights += weight;
+					}
+				}
+				//the pixel itself always has weight, unless its normal is broken
+				if (weights <= 0) {
+					dst[p] = src[p];
+					continue;
+				}
+#ifdef DENOISE_SSE
+				_mm_storeu_ps(dst[p].v, _mm_div_ps(sum, _mm_set1_ps(weights)));
+#else
+				dst[p] = { { sum[0] / weights, sum[1] / weights, sum[2] / weights, 0.0f } };
+#endif
+			}
+		});
+		src.swap(dst);
+	}
+
+	out.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		const Colour& a = features.albedo[i];
+		out[i] = Colour(src[i].v[0] * (a.x + albedo_floor), src[i].v[1] * (a.y + albedo_floor), src[i].v[2] * (a.z + albedo_floor)) * 255.0f;
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "triangles.h"
+#include "bvh.h"
+#include <array>
+#include <map>
+#include <thread>
+
+// a triangle mesh whose vertices move every frame, like the animated water.
+// after a deformation the bvh is refit in place, which is much cheaper than a build but lets the
+// boxes grow as triangles drift away from the ones they were grouped with. the sah cost is checked
+// after each refit and the tree is rebuilt once it is rebuild_threshold times worse than when built,
+// not counting what the lazy subtrees built since then added. the vertex normals are recomputed from
+// the moved faces so the shading follows the deformation
+class dynamic_mesh : public hittable {
+public:
+	dynamic_mesh(const hittable_list& triangles, const bvh_build_options& opts = bvh_build_options(), double threshold = 1.5);
+
+	// moves every vertex to f(rest position), recomputes the vertex normals and updates the bvh
+	template<typename F>
+	void deform(F f);
+
+	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override {
+		return bvh->hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override {
+		return bvh->occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(aabb& output_box) const override {
+		return bvh->bounding_box(output_box);
+	}
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const override {
+		bvh->hit_stream_subset(rays, ids, count, hits);
+	}
+
+	void rebuild();
+
+public:
+	shared_ptr<bvh_node> bvh;
+	hittable_list list;
+	std::vector<triangle*> tris;
+	std::vector<Point3f> rest; // three per triangle, as loaded
+	std::vector<uint32_t> corner_vertex; // three per triangle, the shared vertex each corner is
+	std::vector<float> winding; // per triangle, -1 where the loaded normals face against v0,v1,v2
+	size_t vertex_count = 0;
+	bvh_build_options options;
+	double rebuild_threshold;
+	double built_cost;
+	int refits = 0;
+	int rebuilds = 0;
+};
+
+dynamic_mesh::dynamic_mesh(const hittable_list& triangles, const bvh_build_options& opts, double threshold)
+	: list(triangles), options(opts), rebuild_threshold(threshold) {
+	for (const auto& object : list.objects) {
+		auto tri = dynamic_cast<triangle*>(object.get());
+		if (!tri) continue;
+		tris.push_back(tri);
+		rest.push_back(tri->v0);
+		rest.push_back(tri->v1);
+		rest.push_back(tri->v2);
+	}
+
+	//corners with the same position and the same loaded normal are one vertex, so creases stay sharp
+	std::map<std::array<float, 6>, uint32_t> vertices;
+	for (size_t i = 0; i < tris.size(); i++) {
+		const triangle* tri = tris[i];
+		const Vec3f* normals[3] = { &tri->v0n, &tri->v1n, &tri->v2n };
+		for (int k = 0; k < 3; k++) {
+			const Point3f& p = rest[3 * i + k];
+			const Vec3f& n = *normals[k];
+			std::array<float, 6> key = { { p.x, p.y, p.z, n.x, n.y, n.z } };
+			auto found = vertices.insert(std::make_pair(key, uint32_t(vertices.size())));
+			corner_vertex.push_back(found.first->second);
+		}
+		Vec3f loaded = tri->v0n + tri->v1n + tri->v2n;
+		winding.push_back(tri->normal.dotProduct(loaded) < 0 ? -1.0f : 1.0f);
+	}
+	vertex_count = vertices.size();
+	rebuild();
+}
+
+void dynamic_mesh::rebuild() {
+	bvh = make_shared<bvh_node>(list, options);
+	built_cost = bvh->sah_cost();
+	rebuilds++;
+}
+
+template<typename F>
+void dynamic_mesh::deform(F f) {
+	for (size_t i = 0; i < tris.size(); i++) {
+		triangle* tri = tris[i];
+		tri->v0 = f(rest[3 * i]);
+		tri->v1 = f(rest[3 * i + 1]);
+		tri->v2 = f(rest[3 * i + 2]);
+		tri->normal = (tri->v1 - tri->v0).crossProduct(tri->v2 - tri->v0);
+	}
+
+	//each vertex normal is the sum of the face normals around it, which weights them by area
+	std::vector<Vec3f> normals(vertex_count, Vec3f(0, 0, 0));
+	for (size_t i = 0; i < tris.size(); i++) {
+		Vec3f n = tris[i]->normal * winding[i];
+		for (int k = 0; k < 3; k++) {
+			Vec3f& sum = normals[corner_vertex[3 * i + k]];
+			sum = sum + n;
+		}
+	}
+	for (auto& n : normals) n.normalize();
+	for (size_t i = 0; i < tris.size(); i++) {
+		triangle* tri = tris[i];
+		tri->v0n = normals[corner_vertex[3 * i]];
+		tri->v1n = normals[corner_vertex[3 * i + 1]];
+		tri->v2n = normals[corner_vertex[3 * i + 2]];
+	}
+
+	//split the refit across the pool a few levels below the number of threads
+	int split_depth = 2;
+	for (unsigned n = std::thread::hardware_concurrency(); n > 1; n >>= 1) split_depth++;
+	bvh->refit_parallel(split_depth);
+	refits++;
+
+	//lazy nodes expanded by the renders since the build raise the cost without the tree getting worse
+	double expansions = 0;
+	double cost = bvh->sah_cost(&expansions);
+	if (cost > rebuild_threshold * (built_cost + expansions)) rebuild();
+}
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include "random.h"
 
 template<typename T>
 class Vec2
@@ -54,7 +55,7 @@ typedef Vec2<int> Vec2i;
 // use this convention for instance.
 inline double rand_double() {
     //returning a random real number
-    return rand() / (RAND_MAX + 1.0);
+    return random_unit();
 }
 inline double rand_double(double min, double max) {
     //return a readom real in min max instead of 1,0
@@ -4,7 +4,9 @@
 #include "common.h"
 #include "aabb.h"
 
-class material; //forward delaration of material class
+class hittable;
+struct ray_stream;
+struct hit_stream;
 
 struct hit_record {
 	Point3f p;
@@ -14,8 +16,16 @@ struct hit_record {
 	double v;
 	bool front_face;
 
-	shared_ptr<material>mat_ptr;
+	int mat_id; // index into the scene material_table
 
+	// what hit() records while traversing, p, normal, front_face and u,v are only
+	// filled in by finalize() once the closest hit is known
+	const hittable* prim;
+	const hittable* inst; // instance the primitive was reached through, null in world space
+	float bary_u, bary_v;
+
+	// computes the shading data for the final hit, r is the ray that was traced
+	inline void finalize(const Ray& r);
 
 	inline void set_face_normal(const Ray& r, const Vec3f& outward_normal) {
 		front_face = (r.direction().dotProduct(outward_normal)) < 0;
@@ -31,4 +41,39 @@ public:
 	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const = 0;
 
 	virtual bool bounding_box(aabb& output_box) const = 0;
-};
\ No newline at end of file
+
+	// whether anything lies along r between t_min and t_max, for shadow rays. the default is a closest
+	// hit, containers override it to stop at the first primitive that blocks the ray
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const {
+		hit_record rec;
+		return hit(r, t_min, t_max, rec);
+	}
+
+	// bounds of the part of the primitive inside clip, used by spatial bvh splits.
+	// the default is the plain box cut down to clip which is conservative for any shape
+	virtual bool clipped_bounding_box(const aabb& clip, aabb& output_box) const {
+		aabb full;
+		if (!bounding_box(full)) return false;
+		Point3f small(fmax(full.min().x, clip.min().x), fmax(full.min().y, clip.min().y), fmax(full.min().z, clip.min().z));
+		Point3f big(fmin(full.max().x, clip.max().x), fmin(full.max().y, clip.max().y), fmin(full.max().z, clip.max().z));
+		if (small.x > big.x || small.y > big.y || small.z > big.z) return false;
+		output_box = aabb(small, big);
+		return true;
+	}
+
+	// recompute cached bounds after the geometry underneath has moved, nothing to do for primitives
+	virtual void refit() {}
+
+	// fills in the shading data for a hit this object recorded, r is in the space the hit was found in.
+	// only primitives and instances record hits so containers never need this
+	virtual void get_surface(const Ray& r, hit_record& rec) const {}
+
+	// intersects the rays of a stream listed in ids, see ray_stream.h. the default calls hit() per ray,
+	// acceleration structures override it to test each node once against the whole group. the ids may be
+	// reordered, the first count entries stay the same set, so children narrow the group in place
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const;
+};
+
+inline void hit_record::finalize(const Ray& r) {
+	(inst ? inst : prim)->get_surface(r, *this);
+}
\ No newline at end of file
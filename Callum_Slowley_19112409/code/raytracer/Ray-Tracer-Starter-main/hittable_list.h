@@ -17,6 +17,11 @@ public:
 	void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
 	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec)const override;
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override {
+		for (const auto& object : objects)
+			if (object->occluded(r, t_min, t_max)) return true;
+		return false;
+	}
 
 	virtual bool bounding_box(aabb& output_box) const override;
 
@@ -0,0 +1,114 @@
+#pragma once
+#include "common.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// error measures between a render and a reference, both as linear colours with 1 for full white
+// (a render_pixel sum divided by 255 * spp)
+
+inline double mean_squared_error(const std::vector<Colour>& image, const std::vector<Colour>& reference) {
+	double sum = 0;
+	for (size_t i = 0; i < image.size(); i++)
+		for (int c = 0; c < 3; c++) {
+			double d = double(image[i][c]) - reference[i][c];
+			sum += d * d;
+		}
+	return image.empty() ? 0 : sum / (image.size() * 3);
+}
+
+inline double root_mean_squared_error(const std::vector<Colour>& image, const std::vector<Colour>& reference) {
+	return sqrt(mean_squared_error(image, reference));
+}
+
+// squared error divided by the squared reference, so dark areas count as much as bright ones.
+// the 0.01 keeps black pixels from dominating
+inline double relative_mean_squared_error(const std::vector<Colour>& image, const std::vector<Colour>& reference) {
+	double sum = 0;
+	for (size_t i = 0; i < image.size(); i++)
+		for (int c = 0; c < 3; c++) {
+			double d = double(image[i][c]) - reference[i][c];
+			sum += d * d / (double(reference[i][c]) * reference[i][c] + 0.01);
+		}
+	return image.empty() ? 0 : sum / (image.size() * 3);
+}
+
+// gamma corrected luminance in [0,1], which is closer to what structural similarity was made for
+inline std::vector<double> display_luminance(const std::vector<Colour>& image) {
+	std::vector<double> luminance(image.size());
+	for (size_t i = 0; i < image.size(); i++) {
+		double y = 0.2126 * image[i].x + 0.7152 * image[i].y + 0.0722 * image[i].z;
+		luminance[i] = sqrt(clamp(y, 0, 1));
+	}
+	return luminance;
+}
+
+// mean structural similarity over every 7x7 window, 1 for identical images
+inline double structural_similarity(const std::vector<Colour>& image, const std::vector<Colour>& reference, int width, int height) {
+	const int window = 7;
+	const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+	std::vector<double> a = display_luminance(image), b = display_luminance(reference);
+	double total = 0;
+	int windows = 0;
+	for (int y = 0; y + window <= height; y++) {
+		for (int x = 0; x + window <= width; x++) {
+			double ma = 0, mb = 0;
+			for (int j = 0; j < window; j++)
+				for (int i = 0; i < window; i++) {
+					ma += a[size_t(y + j) * width + x + i];
+					mb += b[size_t(y + j) * width + x + i];
+				}
+			const double n = window * window;
+			ma /= n;
+			mb /= n;
+			double va = 0, vb = 0, cov = 0;
+			for (int j = 0; j < window; j++)
+				for (int i = 0; i < window; i++) {
+					double da = a[size_t(y + j) * width + x + i] - ma;
+					double db = b[size_t(y + j) * width + x + i] - mb;
+					va += da * da;
+					vb += db * db;
+					cov += da * db;
+				}
+			va /= n - 1;
+			vb /= n - 1;
+			cov /= n - 1;
+			total += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+			windows++;
+		}
+	}
+	return windows ? total / windows : 1;
+}
+
+// linear colours as a portable float map, so a reference keeps its full range between runs
+inline bool write_pfm(const std::string& filename, const std::vector<Colour>& image, int width, int height) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) return false;
+	//a negative scale means little endian, rows go bottom to top
+	out << "PF\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(size_t(width) * 3);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			for (int c = 0; c < 3; c++) row[size_t(x) * 3 + c] = image[size_t(y) * width + x][c];
+		out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return bool(out);
+}
+
+// only reads what write_pfm writes
+inline bool read_pfm(const std::string& filename, std::vector<Colour>& image, int& width, int& height) {
+	std::ifstream in(filename, std::ios::binary);
+	std::string magic;
+	float scale = 0;
+	if (!(in >> magic >> width >> height >> scale) || magic != "PF" || scale >= 0 || width <= 0 || height <= 0) return false;
+	in.get();
+	image.assign(size_t(width) * height, Colour(0, 0, 0));
+	std::vector<float> row(size_t(width) * 3);
+	for (int y = 0; y < height; y++) {
+		if (!in.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float))) return false;
+		for (int x = 0; x < width; x++)
+			image[size_t(y) * width + x] = Colour(row[size_t(x) * 3], row[size_t(x) * 3 + 1], row[size_t(x) * 3 + 2]);
+	}
+	return true;
+}
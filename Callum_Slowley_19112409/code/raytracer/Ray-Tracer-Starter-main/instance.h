@@ -0,0 +1,174 @@
+#pragma once
+#include "common.h"
+#include "hittable.h"
+#include "ray_stream.h"
+#include <memory>
+#include <vector>
+
+// one placement of a shared bottom level bvh. rays are moved into object space instead of
+// baking the transform into the triangles, so a mesh is stored once however many copies there are.
+// matrices use the row vector convention of geometry.h, translation lives in x[3][0..2]
+class instance : public hittable {
+public:
+	instance(shared_ptr<hittable> obj, const Matrix44f& object_to_world) : object(obj) { set_transform(object_to_world); }
+
+	void set_transform(const Matrix44f& object_to_world);
+
+	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
+	virtual void get_surface(const Ray& r, hit_record& rec) const override;
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const override;
+
+public:
+	shared_ptr<hittable> object;
+	Matrix44f to_world;
+	Matrix44f to_object;
+	Matrix44f normal_to_world; // inverse transpose, keeps normals perpendicular under non uniform scale
+	bool identity;
+};
+
+inline Matrix44f translation(const Vec3f& t) {
+	Matrix44f m;
+	m[3][0] = t.x;
+	m[3][1] = t.y;
+	m[3][2] = t.z;
+	return m;
+}
+
+inline Matrix44f scaling(double s) {
+	Matrix44f m;
+	m[0][0] = m[1][1] = m[2][2] = s;
+	return m;
+}
+
+inline Matrix44f rotation_y(double degrees) {
+	double theta = degrees_to_radians(degrees);
+	Matrix44f m;
+	m[0][0] = cos(theta);
+	m[0][2] = -sin(theta);
+	m[2][0] = sin(theta);
+	m[2][2] = cos(theta);
+	return m;
+}
+
+void instance::set_transform(const Matrix44f& object_to_world) {
+	to_world = object_to_world;
+	to_object = object_to_world.inverse();
+	normal_to_world = to_object.transposed();
+
+	identity = true;
+	Matrix44f unit;
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			if (to_world[i][j] != unit[i][j]) identity = false;
+}
+
+bool instance::hit(const Ray& r, double t_min, double t_max, hit_record& rec) const {
+	if (identity) return object->hit(r, t_min, t_max, rec);
+
+	//the direction is not renormalised so t is the same in both spaces
+	Point3f origin;
+	Vec3f direction;
+	to_object.multVecMatrix(r.origin(), origin);
+	to_object.multDirMatrix(r.direction(), direction);
+	if (!object->hit(Ray(origin, direction), t_min, t_max, rec)) return false;
+	rec.inst = this;
+	return true;
+}
+
+bool instance::occluded(const Ray& r, double t_min, double t_max) const {
+	if (identity) return object->occluded(r, t_min, t_max);
+	Point3f origin;
+	Vec3f direction;
+	to_object.multVecMatrix(r.origin(), origin);
+	to_object.multDirMatrix(r.direction(), direction);
+	return object->occluded(Ray(origin, direction), t_min, t_max);
+}
+
+void instance::hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const {
+	if (identity) {
+		object->hit_stream_subset(rays, ids, count, hits);
+		return;
+	}
+
+	//the group moves into object space as a stream of its own so the mesh bvh can still test it together.
+	//the buffers are kept per thread and reused, one set for each level of instances inside instances
+	struct scratch {
+		ray_stream rays;
+		hit_stream hits;
+		std::vector<uint32_t> ids;
+	};
+	thread_local std::vector<std::unique_ptr<scratch>> levels;
+	thread_local size_t level = 0;
+	if (levels.size() <= level) levels.emplace_back(new scratch());
+	scratch& local = *levels[level];
+	local.rays.resize(count);
+	local.hits.any_hit = hits.any_hit;
+	local.hits.records.resize(hits.any_hit ? 0 : count);
+	local.hits.closest.resize(count);
+	local.hits.found.resize(count);
+	local.ids.resize(count);
+	for (size_t k = 0; k < count; k++) {
+		uint32_t i = ids[k];
+		Ray r = rays.ray(i);
+		Point3f origin;
+		Vec3f direction;
+		to_object.multVecMatrix(r.origin(), origin);
+		to_object.multDirMatrix(r.direction(), direction);
+		local.rays.set(k, Ray(origin, direction), rays.t_min[i], rays.t_max[i]);
+		local.hits.closest[k] = hits.closest[i];
+		local.hits.found[k] = hits.any_hit ? hits.found[i] : 0;
+		local.ids[k] = static_cast<uint32_t>(k);
+	}
+	level++;
+	object->hit_stream_subset(local.rays, local.ids.data(), count, local.hits);
+	level--;
+
+	for (size_t k = 0; k < count; k++) {
+		uint32_t i = ids[k];
+		if (!local.hits.found[k]) continue;
+		if (hits.any_hit) {
+			hits.found[i] = 1;
+			continue;
+		}
+		if (hits.found[i] && local.hits.closest[k] >= hits.closest[i]) continue;
+		hits.records[i] = local.hits.records[k];
+		hits.records[i].inst = this;
+		hits.closest[i] = local.hits.closest[k];
+		hits.found[i] = 1;
+	}
+}
+
+void instance::get_surface(const Ray& r, hit_record& rec) const {
+	//redo the object space ray so the primitive sees the same ray it was hit with
+	Point3f origin;
+	Vec3f direction;
+	to_object.multVecMatrix(r.origin(), origin);
+	to_object.multDirMatrix(r.direction(), direction);
+	rec.prim->get_surface(Ray(origin, direction), rec);
+
+	rec.p = r.at(rec.t);
+	Vec3f normal;
+	normal_to_world.multDirMatrix(rec.normal, normal);
+	rec.normal = normal.normalize();
+}
+
+bool instance::bounding_box(aabb& output_box) const {
+	aabb local;
+	if (!object->bounding_box(local)) return false;
+
+	//box around all eight transformed corners
+	Point3f small(infinity, infinity, infinity), big(-infinity, -infinity, -infinity);
+	for (int i = 0; i < 8; i++) {
+		Point3f corner((i & 1) ? local.max().x : local.min().x, (i & 2) ? local.max().y : local.min().y, (i & 4) ? local.max().z : local.min().z);
+		Point3f p;
+		to_world.multVecMatrix(corner, p);
+		for (int a = 0; a < 3; a++) {
+			small[a] = fmin(small[a], p[a]);
+			big[a] = fmax(big[a], p[a]);
+		}
+	}
+	output_box = aabb(small, big);
+	return true;
+}
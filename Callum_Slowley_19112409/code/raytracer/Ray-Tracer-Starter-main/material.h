@@ -3,16 +3,10 @@
 #include "geometry.h"
 #include "hittable.h"
 #include "Texture.h"
+#include <cstdint>
+#include <vector>
 struct hit_record;
 
-class material {
-public:
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const = 0;
-	virtual Colour emitted() const {
-		return Colour(0, 0, 0);
-	}
-};
-
 Vec3f reflect(const Vec3f& v, const Vec3f& n) {
 	return v - 2 * v.dotProduct(n) * n;
 }
@@ -24,17 +18,17 @@ Vec3f refract(const Vec3f& uv, const Vec3f& n, double etai_over_etat) {
 	return r_out_perp + r_out_parallel;
 }
 
-//material types
+//material types, a closed set dispatched by material_table below so scatter calls can be inlined
 
-class dielectric : public material {
+class dielectric {
 public:
 	dielectric(double index_of_refraction) : ir(index_of_refraction) {}
 	
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const override {
+	bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
 		attenuation = Colour(1.0, 1.0, 1.0);
 		double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 		
-		Vec3f unit_direction = r_in.direction().normalize();
+		Vec3f unit_direction = r_in.unit_direction();
 		double cos_theta = fmin(-unit_direction.dotProduct(rec.normal), 1.0);
 		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
@@ -63,15 +57,15 @@ private:
 	}
 };
 
-class Water : public material {
+class Water {
 public:
 	Water(double index_of_refraction) : ir(index_of_refraction) {}
 
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const override {
+	bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
 		attenuation = Colour(0, 1, 1);
 		double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
-		Vec3f unit_direction = r_in.direction().normalize();
+		Vec3f unit_direction = r_in.unit_direction();
 		double cos_theta = fmin(-unit_direction.dotProduct(rec.normal), 1.0);
 		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
@@ -100,13 +94,13 @@ private:
 	}
 };
 
-class metal : public material {
+class metal {
 public:
 	//f is fuzzy, approficmaiton of rough
 	metal(const Colour& a, double f) : albedo(a), fuzz(f <1?f:1) {}
 
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const override {
-		Vec3f reflected = reflect(r_in.direction().normalize(), rec.normal);
+	bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
+		Vec3f reflected = reflect(r_in.unit_direction(), rec.normal);
 		scattered = Ray(rec.p, reflected+fuzz*Vec3f().random_in_unit_sphere());
 		attenuation = albedo;
 		return (scattered.direction().dotProduct(rec.normal) > 0);
@@ -116,12 +110,12 @@ public:
 	double fuzz;
 };
 
-class lambertian : public material {
+class lambertian {
 public:
 	lambertian(const Colour& a) : Albedo(make_shared<solid_colour>(a)) {}
 	lambertian(const shared_ptr<Texture> a) : Albedo(a) {}
 
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const override {
+	bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
 		auto scatter_direction = rec.normal + Vec3f().random_in_unit_sphere();
 		//catching degenearte scatter direction
 		if (scatter_direction.near_zero())
@@ -135,16 +129,84 @@ public:
 	shared_ptr<Texture> Albedo;
 };
 
-class diffuse_light : public material {
+class diffuse_light {
 public:
 	diffuse_light(){}
 	diffuse_light(Colour c) :emit(make_shared<Colour>(c)) {}
-	virtual bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const override {
+	bool scatter(const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
 		return false;
 	}
-	virtual Colour emitted() const override {
+	Colour emitted() const {
 		return *emit;
 	}
 public:
 	shared_ptr<Colour> emit;
+};
+
+enum class material_type : uint8_t { lambertian, metal, dielectric, water, diffuse_light };
+
+// every material in a scene, stored by value per type. primitives and hit records only carry the id
+// add() returns, so a hit costs no shared_ptr refcounting and scatter is a switch rather than a virtual call
+class material_table {
+public:
+	int add(const lambertian& m) { return add_entry(material_type::lambertian, lambertians, m); }
+	int add(const metal& m) { return add_entry(material_type::metal, metals, m); }
+	int add(const dielectric& m) { return add_entry(material_type::dielectric, dielectrics, m); }
+	int add(const Water& m) { return add_entry(material_type::water, waters, m); }
+	int add(const diffuse_light& m) { return add_entry(material_type::diffuse_light, lights, m); }
+
+	material_type type(int id) const { return entries[id].type; }
+	size_t size() const { return entries.size(); }
+
+	bool scatter(int id, const Ray& r_in, const hit_record& rec, Colour& attenuation, Ray& scattered) const {
+		const entry& e = entries[id];
+		counters().scatters[static_cast<int>(e.type)]++;
+		switch (e.type) {
+		case material_type::lambertian: return lambertians[e.index].scatter(r_in, rec, attenuation, scattered);
+		case material_type::metal: return metals[e.index].scatter(r_in, rec, attenuation, scattered);
+		case material_type::dielectric: return dielectrics[e.index].scatter(r_in, rec, attenuation, scattered);
+		case material_type::water: return waters[e.index].scatter(r_in, rec, attenuation, scattered);
+		case material_type::diffuse_light: return lights[e.index].scatter(r_in, rec, attenuation, scattered);
+		}
+		return false;
+	}
+
+	// the colour a hit reflects before any lighting, for the denoiser. white for glass, water and lights
+	Colour albedo(int id, const hit_record& rec) const {
+		const entry& e = entries[id];
+		switch (e.type) {
+		case material_type::lambertian: return lambertians[e.index].Albedo->colour_Value(rec.u, rec.v, rec.p);
+		case material_type::metal: return metals[e.index].albedo;
+		default: return Colour(1, 1, 1);
+		}
+	}
+
+	Colour emitted(int id) const {
+		const entry& e = entries[id];
+		if (e.type == material_type::diffuse_light) return lights[e.index].emitted();
+		return Colour(0, 0, 0);
+	}
+
+private:
+	struct entry {
+		material_type type;
+		uint32_t index; // into the vector for that type
+	};
+
+	template<typename T>
+	int add_entry(material_type type, std::vector<T>& store, const T& m) {
+		entry e;
+		e.type = type;
+		e.index = static_cast<uint32_t>(store.size());
+		store.push_back(m);
+		entries.push_back(e);
+		return static_cast<int>(entries.size() - 1);
+	}
+
+	std::vector<entry> entries;
+	std::vector<lambertian> lambertians;
+	std::vector<metal> metals;
+	std::vector<dielectric> dielectrics;
+	std::vector<Water> waters;
+	std::vector<diffuse_light> lights;
 };
\ No newline at end of file
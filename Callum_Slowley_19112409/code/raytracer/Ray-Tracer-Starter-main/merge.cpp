@@ -0,0 +1,98 @@
+// Adds up partial images from raytracer --headless --partial into the final image. parts may cover
+// different pixels, like the tiles of a distributed render, or the same pixels rendered with
+// different seeds, which adds their samples. parts of another scene, or parts with the same seed
+// covering the same pixel, which would count the same samples twice, are refused.
+// see README.md for the build command.
+//
+// usage: merge [--output raytracer_renderer.tga|file.pfm] part...
+
+#include "common.h"
+#include "partial.h"
+#include "render.h"
+#include "image_metrics.h"
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+	std::string output = "raytracer_renderer.tga";
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+		else inputs.push_back(argv[i]);
+	}
+	if (inputs.empty()) {
+		std::cerr << "usage: merge [--output raytracer_renderer.tga|file.pfm] part..." << std::endl;
+		return 2;
+	}
+
+	int width = 0, height = 0;
+	std::string scene;
+	std::vector<Colour> sums;
+	std::vector<int> samples;
+	std::map<uint64_t, std::vector<uint8_t>> covered; // pixels each seed has been merged for
+	for (const std::string& name : inputs) {
+		partial_image part;
+		if (!part.read(name)) {
+			std::cerr << "could not read " << name << std::endl;
+			return 1;
+		}
+		if (width == 0) {
+			width = part.width;
+			height = part.height;
+			scene = part.scene;
+		}
+		if (part.scene != scene) {
+			std::cerr << name << " is a render of " << part.scene << ", not " << scene << std::endl;
+			return 1;
+		}
+		if (part.width == width && part.height == height) {
+			std::vector<uint8_t>& seen = covered[part.seed];
+			seen.resize(size_t(width) * height, 0);
+			size_t repeated = 0;
+			for (const pixel_rect& r : part.rects) {
+				for (int y = r.y0; y < r.y1; y++) {
+					for (int x = r.x0; x < r.x1; x++) {
+						uint8_t& s = seen[size_t(y) * width + x];
+						repeated += s;
+						s = 1;
+					}
+				}
+			}
+			if (repeated) {
+				std::cerr << name << " repeats " << repeated << " pixels already merged with seed " << part.seed << std::endl;
+				return 1;
+			}
+		}
+		if (!merge_partial(part, width, height, sums, samples)) {
+			std::cerr << name << " is " << part.width << "x" << part.height << ", not " << width << "x" << height << std::endl;
+			return 1;
+		}
+		std::cerr << "# " << name << ": " << part.rects.size() << " rects, " << part.spp << " spp, seed " << part.seed << std::endl;
+	}
+
+	//the average of every pixel, as a sum of one sample for to_image
+	size_t missing = 0;
+	std::vector<Colour> average(sums.size(), Colour(0, 0, 0));
+	for (size_t i = 0; i < sums.size(); i++) {
+		if (samples[i] == 0) missing++;
+		else average[i] = sums[i] / float(samples[i]);
+	}
+	if (missing) std::cerr << missing << " pixels are in none of the parts and are left black" << std::endl;
+
+	bool written;
+	if (output.size() > 4 && output.compare(output.size() - 4, 4, ".pfm") == 0) {
+		for (Colour& c : average) c = c / 255.f;
+		written = write_pfm(output, average, width, height);
+	}
+	else {
+		written = to_image(average, width, height, 1).write_tga_file(output.c_str());
+	}
+	if (!written) {
+		std::cerr << "could not write " << output << std::endl;
+		return 1;
+	}
+	return missing ? 1 : 0;
+}
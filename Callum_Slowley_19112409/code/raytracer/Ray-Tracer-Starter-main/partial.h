@@ -0,0 +1,134 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include "render.h"
+#include "Multithreading.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// part of an image rendered by one process, so a still can be split over processes and machines.
+// pixels keep the seed they would have in a full render, so merging the parts of one seed gives
+// exactly the full image and parts of different seeds add up to more samples per pixel
+
+struct pixel_rect {
+	int x0, y0, x1, y1; // x1 and y1 are one past the end
+
+	int width() const { return x1 - x0; }
+	int height() const { return y1 - y0; }
+	size_t pixels() const { return size_t(std::max(0, width())) * std::max(0, height()); }
+};
+
+struct partial_image {
+	int width = 0, height = 0; // of the whole image
+	int spp = 0;
+	uint64_t seed = 0;
+	std::string scene;
+	std::vector<pixel_rect> rects;
+	std::vector<Colour> sums; // render_pixel sums, rect after rect and row after row inside each
+
+	// a text header with the metadata and the rects, then the sums as raw floats
+	bool write(const std::string& filename) const;
+	bool read(const std::string& filename);
+};
+
+// the tile_size squares of a width by height image, every count'th one starting at index.
+// interleaving spreads the expensive parts of the image over all the workers
+inline std::vector<pixel_rect> tile_subset(int width, int height, int tile_size, int index, int count) {
+	std::vector<pixel_rect> tiles;
+	int step = std::max(1, tile_size);
+	int n = 0;
+	for (int y = 0; y < height; y += step)
+		for (int x = 0; x < width; x += step, n++)
+			if (n % count == index) tiles.push_back({ x, y, std::min(width, x + step), std::min(height, y + step) });
+	return tiles;
+}
+
+// renders every rect of part, rows shared out over a thread pool. part.rects, width, height and
+// the settings must be filled in, the sums are replaced
+void render_partial(const scene& world, const camera& cam, const render_settings& settings, partial_image& part) {
+	part.spp = settings.spp;
+	part.seed = settings.seed;
+	std::vector<size_t> offsets;
+	size_t total = 0;
+	for (const pixel_rect& r : part.rects) {
+		offsets.push_back(total);
+		total += r.pixels();
+	}
+	part.sums.assign(total, Colour(0, 0, 0));
+
+	ThreadPool pool(static_cast<short>(std::max(1, settings.threads)));
+	for (size_t k = 0; k < part.rects.size(); k++) {
+		const pixel_rect& r = part.rects[k];
+		for (int y = r.y0; y < r.y1; y++) {
+			Colour* row = part.sums.data() + offsets[k] + size_t(y - r.y0) * r.width();
+			pool.Enqueue([&world, &cam, &settings, &part, r, y, row] {
+				for (int x = r.x0; x < r.x1; x++)
+					row[x - r.x0] = render_pixel(world, cam, x, y, part.width, part.height, settings.spp, settings.max_depth, settings.seed);
+			});
+		}
+	}
+}
+
+bool partial_image::write(const std::string& filename) const {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) return false;
+	out << "raytracer-partial 1\n" << "scene " << scene << "\n" << "size " << width << " " << height << "\n"
+		<< "spp " << spp << "\n" << "seed " << seed << "\n" << "rects " << rects.size() << "\n";
+	for (const pixel_rect& r : rects) out << r.x0 << " " << r.y0 << " " << r.x1 << " " << r.y1 << "\n";
+	out << "data\n";
+	out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(Colour));
+	return bool(out);
+}
+
+bool partial_image::read(const std::string& filename) {
+	std::ifstream in(filename, std::ios::binary);
+	std::string magic, key;
+	int version = 0;
+	size_t count = 0;
+	if (!(in >> magic >> version) || magic != "raytracer-partial" || version != 1) return false;
+	if (!(in >> key >> scene) || key != "scene") return false;
+	if (!(in >> key >> width >> height) || key != "size") return false;
+	if (!(in >> key >> spp) || key != "spp") return false;
+	if (!(in >> key >> seed) || key != "seed") return false;
+	if (!(in >> key >> count) || key != "rects") return false;
+	rects.resize(count);
+	size_t total = 0;
+	for (pixel_rect& r : rects) {
+		if (!(in >> r.x0 >> r.y0 >> r.x1 >> r.y1)) return false;
+		if (r.x0 < 0 || r.y0 < 0 || r.x1 > width || r.y1 > height) return false;
+		total += r.pixels();
+	}
+	if (!(in >> key) || key != "data") return false;
+	in.get();
+	sums.resize(total);
+	return bool(in.read(reinterpret_cast<char*>(sums.data()), total * sizeof(Colour)));
+}
+
+// adds part into the sums and sample counts of the whole image, false if it is for another size
+inline bool merge_partial(const partial_image& part, int width, int height, std::vector<Colour>& sums, std::vector<int>& samples) {
+	if (part.width != width || part.height != height) return false;
+	sums.resize(size_t(width) * height, Colour(0, 0, 0));
+	samples.resize(size_t(width) * height, 0);
+	const Colour* src = part.sums.data();
+	for (const pixel_rect& r : part.rects) {
+		for (int y = r.y0; y < r.y1; y++) {
+			for (int x = r.x0; x < r.x1; x++, src++) {
+				size_t i = size_t(y) * width + x;
+				sums[i] = sums[i] + *src;
+				samples[i] += part.spp;
+			}
+		}
+	}
+	return true;
+}
+
+// parses "x0,y0,x1,y1"
+inline bool parse_rect(const std::string& text, pixel_rect& rect) {
+	char c1, c2, c3;
+	std::istringstream in(text);
+	return (in >> rect.x0 >> c1 >> rect.y0 >> c2 >> rect.x1 >> c3 >> rect.y1) && c1 == ',' && c2 == ',' && c3 == ',';
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// the random numbers used for sampling. every thread has a generator of its own, so the render
+// threads do not queue on the lock inside rand() and a render can be repeated exactly by seeding
+// each pixel (see render_pixel). xorshift64*, which is plenty for sample positions and directions
+
+inline uint64_t mix_seed(uint64_t seed) {
+	//splitmix64 so neighbouring seeds, like neighbouring pixels, start far apart
+	uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	return z ? z : 1;
+}
+
+// the seed for pass `pass` of a progressive render started from seed. pass 0 is seed itself, so a single
+// pass render matches its partial tiles. later passes hash both, with seed + pass runs with seeds 1 and 2
+// would share all but one of their passes
+inline uint64_t pass_seed(uint64_t seed, uint64_t pass) {
+	return pass == 0 ? seed : mix_seed(mix_seed(seed) + pass);
+}
+
+// a thread nobody seeds starts from its id, so worker threads do not all draw the same numbers
+inline uint64_t& random_state() {
+	thread_local uint64_t state = mix_seed(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	return state;
+}
+
+inline void seed_random(uint64_t seed) {
+	random_state() = mix_seed(seed);
+}
+
+// a random real in [0,1)
+inline double random_unit() {
+	uint64_t& x = random_state();
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	return ((x * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "common.h"
+#include "hittable.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// many rays laid out one array per component, so a box test over a group of them is a plain loop
+// the compiler can vectorise. the reciprocal directions are worked out once when a ray is added
+struct ray_stream {
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> inv_dx, inv_dy, inv_dz;
+	std::vector<float> t_min, t_max;
+
+	size_t size() const { return ox.size(); }
+	void clear() { resize(0); }
+	void reserve(size_t n);
+	void resize(size_t n);
+	void set(size_t i, const Ray& r, double tmin, double tmax);
+	void add(const Ray& r, double tmin = 0.001, double tmax = infinity) {
+		resize(size() + 1);
+		set(size() - 1, r, tmin, tmax);
+	}
+	Ray ray(size_t i) const { return Ray(Point3f(ox[i], oy[i], oz[i]), Vec3f(dx[i], dy[i], dz[i]), Vec3f(inv_dx[i], inv_dy[i], inv_dz[i])); }
+};
+
+// results for a ray_stream, entry i belongs to ray i. closest shrinks as hits are found.
+// for any_hit queries the traversal stops following a ray as soon as it is blocked and there
+// are no records
+struct hit_stream {
+	std::vector<hit_record> records;
+	std::vector<float> closest;
+	std::vector<uint8_t> found;
+	bool any_hit = false;
+
+	void reset(const ray_stream& rays, bool any);
+};
+
+void ray_stream::reserve(size_t n) {
+	for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &inv_dx, &inv_dy, &inv_dz, &t_min, &t_max }) v->reserve(n);
+}
+
+void ray_stream::resize(size_t n) {
+	for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &inv_dx, &inv_dy, &inv_dz, &t_min, &t_max }) v->resize(n);
+}
+
+void ray_stream::set(size_t i, const Ray& r, double tmin, double tmax) {
+	ox[i] = r.origin().x; oy[i] = r.origin().y; oz[i] = r.origin().z;
+	dx[i] = r.direction().x; dy[i] = r.direction().y; dz[i] = r.direction().z;
+	inv_dx[i] = 1.0f / dx[i]; inv_dy[i] = 1.0f / dy[i]; inv_dz[i] = 1.0f / dz[i];
+	t_min[i] = static_cast<float>(tmin);
+	t_max[i] = static_cast<float>(tmax);
+}
+
+void hit_stream::reset(const ray_stream& rays, bool any) {
+	any_hit = any;
+	records.resize(any ? 0 : rays.size());
+	closest = rays.t_max;
+	found.assign(rays.size(), 0);
+}
+
+// default for anything without a stream traversal of its own, one hit() or occluded() per ray
+void hittable::hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const {
+	for (size_t k = 0; k < count; k++) {
+		uint32_t i = ids[k];
+		if (hits.any_hit) {
+			if (!hits.found[i] && occluded(rays.ray(i), rays.t_min[i], hits.closest[i])) hits.found[i] = 1;
+			continue;
+		}
+		if (hit(rays.ray(i), rays.t_min[i], hits.closest[i], hits.records[i])) {
+			hits.found[i] = 1;
+			hits.closest[i] = static_cast<float>(hits.records[i].t);
+		}
+	}
+}
+
+// narrows [t0, t1] to one slab. the near plane is picked by direction like aabb::hit, and a NaN from the
+// origin lying on a plane of a ray parallel to it fails both comparisons, so that axis is skipped
+inline void clip_slab(float lo, float hi, float origin, float inv_d, float& t0, float& t1) {
+	float near_t = ((inv_d < 0 ? hi : lo) - origin) * inv_d;
+	float far_t = ((inv_d < 0 ? lo : hi) - origin) * inv_d;
+	t0 = near_t > t0 ? near_t : t0;
+	t1 = far_t < t1 ? far_t : t1;
+}
+
+// moves the ids of the rays that enter box before their current closest hit to the front, returns how many
+inline size_t filter_box(const aabb& box, const ray_stream& rays, uint32_t* ids, size_t count, const hit_stream& hits) {
+	const float lo[3] = { box.min().x, box.min().y, box.min().z };
+	const float hi[3] = { box.max().x, box.max().y, box.max().z };
+	size_t kept = 0;
+	counters().box_tests += count;
+	for (size_t k = 0; k < count; k++) {
+		uint32_t i = ids[k];
+		float t0 = rays.t_min[i], t1 = hits.closest[i];
+		clip_slab(lo[0], hi[0], rays.ox[i], rays.inv_dx[i], t0, t1);
+		clip_slab(lo[1], hi[1], rays.oy[i], rays.inv_dy[i], t0, t1);
+		clip_slab(lo[2], hi[2], rays.oz[i], rays.inv_dz[i], t0, t1);
+		bool live = !(hits.any_hit && hits.found[i]);
+		//swapped unconditionally so the loop has no branch, only the count moves. the entries from kept
+		//to k are all rays that missed, so a miss just trades places with one of them
+		ids[k] = ids[kept];
+		ids[kept] = i;
+		kept += (t0 < t1 && live) ? 1 : 0;
+	}
+	return kept;
+}
+
+// rays handed to world together by intersect and occluded
+const size_t stream_packet = 64;
+
+// hands the stream to world a packet of neighbouring rays at a time, so the arrays each node gathers
+// from stay in the cache. a packet whose rays do not all point into the same octant would split up at
+// the first few nodes and cost more than tracing its rays one by one, so it is traced that way instead
+inline void traverse_packets(const hittable& world, const ray_stream& rays, hit_stream& hits) {
+	uint32_t ids[stream_packet];
+	for (size_t first = 0; first < rays.size(); first += stream_packet) {
+		size_t count = std::min(stream_packet, rays.size() - first);
+		int octants = 0;
+		for (size_t k = 0; k < count; k++) {
+			size_t i = first + k;
+			ids[k] = static_cast<uint32_t>(i);
+			octants |= 1 << ((rays.dx[i] < 0) | (rays.dy[i] < 0) << 1 | (rays.dz[i] < 0) << 2);
+		}
+		if ((octants & (octants - 1)) == 0) world.hit_stream_subset(rays, ids, count, hits);
+		else world.hittable::hit_stream_subset(rays, ids, count, hits);
+	}
+}
+
+// closest hit for every ray in the stream
+inline void intersect(const hittable& world, const ray_stream& rays, hit_stream& hits) {
+	hits.reset(rays, false);
+	traverse_packets(world, rays, hits);
+}
+
+// whether anything lies along each ray between t_min and t_max, for shadow rays. each ray is dropped from
+// the group once blocked. a single shadow ray is cheaper through hittable::occluded
+inline void occluded(const hittable& world, const ray_stream& rays, std::vector<uint8_t>& blocked) {
+	counters().shadow_rays += rays.size();
+	hit_stream hits;
+	hits.reset(rays, true);
+	traverse_packets(world, rays, hits);
+	blocked.swap(hits.found);
+}
@@ -1,7 +1,9 @@
 ﻿// A practical implementation of the ray tracing algorithm.
 
 #include "geometry.h"
+#ifndef RAYTRACER_HEADLESS
 #include "SDL.h" 
+#endif
 #include "Ray.h"
 #include "sphere.h"
 #include "common.h"
@@ -13,14 +15,36 @@
 #include "model.h"
 #include "triangles.h"
 #include "bvh.h"
+#include "instance.h"
+#include "scene.h"
+#include "wavefront.h"
+#include "counters.h"
+#include "aov.h"
+#include "render.h"
+#include "scenes.h"
+#include "batch.h"
+#include "budget.h"
+#include "temporal.h"
+#include "denoise.h"
 #include "Texture.h"
 #include "rtw_stb_image.h"
 #include "tgaimage.h"
 #include <fstream>
 #include <chrono>
+#include <cstring>
+#include <atomic>
 
+#ifndef M_PI
 #define M_PI 3.14159265359
+#endif
 
+#ifdef RAYTRACER_HEADLESS
+//built without SDL for machines with no display, every run is a --headless render. see README.md
+int main(int argc, char **argv)
+{
+    return batch_main(argc, argv);
+}
+#else
 SDL_Window* window;
 SDL_Renderer* renderer;
 SDL_Surface* screen;
@@ -88,234 +112,46 @@ void clamp255(Vec3f& col) {
 }
 
 
-Colour ray_colour(const Ray& r,const Colour& background, const hittable& world, int depth) {
-    hit_record rec;
-    //if we have hit the depth limit no more light has been gathered
-    if (depth <= 0)  return Colour(0, 0, 0); 
-    if (!world.hit(r, 0.001, infinity, rec)) { return background; }
-    Ray scattered;
-    Colour attenuation;
-    Colour emitted = rec.mat_ptr->emitted();
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted; 
-    return attenuation * ray_colour(scattered, background, world, depth - 1);
+//scale spp and gamma correct, then write to the window and the tga
+void put_colour(SDL_Surface* screen, int x, int y, Colour pix_col, int spp) {
+    pix_col = display_colour(pix_col, spp);
+    Uint32 colour = SDL_MapRGB(screen->format, pix_col.x, pix_col.y, pix_col.z);
+    //used from week 2 work 
+    TGAColor tgacolour(pix_col.x, pix_col.y, pix_col.z, 255);
+    putpixel(screen, x, y, colour);
+    image.set(x, y, tgacolour);
 }
-void lineRender(SDL_Surface*screen, hittable_list world, int y, int spp, int max_depth, camera*cam) {
-    Colour background(0, 0, 0);
+//with scale above 1 the row is a preview, one sample from the middle of each scale by scale block
+//filling the whole block. gives up part way through once cancel is set. with frame the full resolution
+//sums go there instead of to the screen, to be blended with earlier frames and/or denoised first
+void lineRender(SDL_Surface*screen, const scene& world, int y, int spp, int max_depth, camera*cam, aov_buffers* aov, uint64_t seed, int scale, const std::atomic<bool>* cancel, temporal_frame* frame) {
     const auto aspect_ratio = 16.0 / 9.0;
     const int image_width = screen->w;
     const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const Colour black(0, 0, 0);
-    Colour pix_col(black);
 
-        for (int x = 0; x < screen->w; ++x) {
-            pix_col = black; //resets the colour per pixel to black
-            for (int s = 0; s < spp; s++) {
-                auto u = double(x + random_double()) / (image_width - 1);
-                auto v = double(y + random_double()) / (image_height - 1);
-                Ray ray = cam->get_ray(u, v);
-                Vec3f unit_direction = ray.direction().normalize();
-                auto t = 0.5 * (unit_direction.y + 1.0);
-                background = (1.0 - t) * Colour(1.0, 1.0, 1.0) + t * Colour(0.5, 0.7, 1.0) * 255;
-                //colours for every sample
-                pix_col = pix_col + ray_colour(ray,background, world, max_depth);
+        for (int x = 0; x < screen->w; x += scale) {
+            if (cancel->load(std::memory_order_relaxed)) return;
+            if (scale == 1) {
+                aov_pixel cost(aov, x, y);
+                Colour pix_col = render_pixel(world, *cam, x, y, image_width, image_height, spp, max_depth, seed);
+                if (frame) frame->record(world, *cam, x, y, image_width, image_height, pix_col);
+                else put_colour(screen, x, y, pix_col, spp);
+                cost.finish(spp);
+                continue;
             }
-            //scale spp and gamma correct
-            pix_col /= 255.f * spp;
-            pix_col.x = sqrt(pix_col.x);
-            pix_col.y = sqrt(pix_col.y);
-            pix_col.z = sqrt(pix_col.z);
-            pix_col *= 255;
-            Uint32 colour = SDL_MapRGB(screen->format, pix_col.x, pix_col.y, pix_col.z);
-            //used from week 2 work 
-            TGAColor tgacolour(pix_col.x, pix_col.y, pix_col.z, 255);
-            putpixel(screen, x, y, colour);
-            image.set(x, y, tgacolour);
+            int x1 = std::min(x + scale, screen->w), y1 = std::min(y + scale, screen->h);
+            Colour pix_col = render_pixel(world, *cam, (x + x1) / 2, (y + y1) / 2, image_width, image_height, 1, max_depth, seed);
+            for (int by = y; by < y1; by++)
+                for (int bx = x; bx < x1; bx++)
+                    put_colour(screen, bx, by, pix_col, 1);
         }
     }
 
-hittable_list test_scene() {
-    hittable_list world;
-    Model* model = new Model("table.obj");
-    Model* handle = new Model("Handle.obj");
-    Model* mirror = new Model("Mirror.obj");
-    Model* mirrorinner = new Model("MirrorInner.obj");
-    Model* glassball = new Model("Water.obj");
-    Model* water = new Model("Waterball.obj");
-    Model* flower = new Model("Damdelion.obj");
-    Model* wall = new Model("Wall.obj");
-    Model* floor = new Model("Floor.obj");
-    Model* areaLight = new Model("AreaLight.obj");
-
-    //loading table model 
-    auto transform= Vec3f(0, 0, 0);
-    auto mat_texture = make_shared<image_texture>("TableUvs.jpg");
-    auto mat_diffuse = make_shared<lambertian>(make_shared<image_texture>("TableUvs.jpg"));
-    for (uint32_t i = 0; i < model->nfaces(); i++) {
-        const Vec3f& v0 = model->vert(model->face(i)[0]);
-        const Vec3f& v1 = model->vert(model->face(i)[1]);
-        const Vec3f& v2 = model->vert(model->face(i)[2]);
-
-        const Vec3f& v0N = model->vnorms(model->vNorms(i)[0]);
-        const Vec3f& v1N = model->vnorms(model->vNorms(i)[1]);
-        const Vec3f& v2N = model->vnorms(model->vNorms(i)[2]);
-
-        const Vec2f& UVu = model->vt(model->uvs(i)[0]);
-        const Vec2f& UVy = model->vt(model->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform,v0N,v1N,v2N, UVu, UVy,mat_diffuse));
-    }
-    ////loading table handel 
-    auto metal_diffuse = make_shared<metal>(Colour(0, 0, 0),0);
-    for (uint32_t i = 0; i < handle->nfaces(); i++) {
-        const Vec3f& v0 = handle->vert(handle->face(i)[0]);
-        const Vec3f& v1 = handle->vert(handle->face(i)[1]);
-        const Vec3f& v2 = handle->vert(handle->face(i)[2]);
-
-        const Vec3f& v0N = handle->vnorms(handle->vNorms(i)[0]);
-        const Vec3f& v1N = handle->vnorms(handle->vNorms(i)[1]);
-        const Vec3f& v2N = handle->vnorms(handle->vNorms(i)[2]);
-
-        const Vec2f& UVu = handle->vt(handle->uvs(i)[0]);
-        const Vec2f& UVy = handle->vt(handle->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, metal_diffuse));
-    }
-    ////loading mirror
-    mat_diffuse = make_shared<lambertian>(Colour(0,1,1));
-    for (uint32_t i = 0; i < mirror->nfaces(); i++) {
-        const Vec3f& v0 = mirror->vert(mirror->face(i)[0]);
-        const Vec3f& v1 = mirror->vert(mirror->face(i)[1]);
-        const Vec3f& v2 = mirror->vert(mirror->face(i)[2]);
-
-        const Vec3f& v0N = mirror->vnorms(mirror->vNorms(i)[0]);
-        const Vec3f& v1N = mirror->vnorms(mirror->vNorms(i)[1]);
-        const Vec3f& v2N = mirror->vnorms(mirror->vNorms(i)[2]);
-
-        const Vec2f& UVu = mirror->vt(mirror->uvs(i)[0]);
-        const Vec2f& UVy = mirror->vt(mirror->uvs(i)[1]);
-
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N, UVu,UVy, mat_diffuse));
-    }
-    ////loading mirrorinner  
-     metal_diffuse = make_shared<metal>(Colour(.5, .5, .5), 0);
-    for (uint32_t i = 0; i < mirrorinner->nfaces(); i++) {
-        const Vec3f& v0 = mirrorinner->vert(mirrorinner->face(i)[0]);
-        const Vec3f& v1 = mirrorinner->vert(mirrorinner->face(i)[1]);
-        const Vec3f& v2 = mirrorinner->vert(mirrorinner->face(i)[2]);
-
-        const Vec3f& v0N = mirrorinner->vnorms(mirrorinner->vNorms(i)[0]);
-        const Vec3f& v1N = mirrorinner->vnorms(mirrorinner->vNorms(i)[1]);
-        const Vec3f& v2N = mirrorinner->vnorms(mirrorinner->vNorms(i)[2]);
-
-        const Vec2f& UVu = mirrorinner->vt(mirrorinner->uvs(i)[0]);
-        const Vec2f& UVy = mirrorinner->vt(mirrorinner->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N, UVu,UVy, metal_diffuse));
-    }
-    ////loading glass ball
-    auto glass_diffuse = make_shared<dielectric>(1.5);
-    for (uint32_t i = 0; i < glassball->nfaces(); i++) {
-        const Vec3f& v0 = glassball->vert(glassball->face(i)[0]);
-        const Vec3f& v1 = glassball->vert(glassball->face(i)[1]);
-        const Vec3f& v2 = glassball->vert(glassball->face(i)[2]);
-
-        const Vec3f& v0N = glassball->vnorms(glassball->vNorms(i)[0]);
-        const Vec3f& v1N = glassball->vnorms(glassball->vNorms(i)[1]);
-        const Vec3f& v2N = glassball->vnorms(glassball->vNorms(i)[2]);
-
-        const Vec2f& UVu = glassball->vt(glassball->uvs(i)[0]);
-        const Vec2f& UVy = glassball->vt(glassball->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, glass_diffuse));
-    }
-    ////loading water
-    auto water_mat = make_shared<Water>(1.3);
-    for (uint32_t i = 0; i < water->nfaces(); i++) {
-        const Vec3f& v0 = water->vert(water->face(i)[0]);
-        const Vec3f& v1 = water->vert(water->face(i)[1]);
-        const Vec3f& v2 = water->vert(water->face(i)[2]);
-
-        const Vec3f& v0N = water->vnorms(water->vNorms(i)[0]);
-        const Vec3f& v1N = water->vnorms(water->vNorms(i)[1]);
-        const Vec3f& v2N = water->vnorms(water->vNorms(i)[2]);
-
-        const Vec2f& UVu = water->vt(water->uvs(i)[0]);
-        const Vec2f& UVy = water->vt(water->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, water_mat));
-    }
-    //////loading wall
-    mat_diffuse = make_shared<lambertian>(Colour(0.5, 0.5, 0.5));
-    for (uint32_t i = 0; i < wall->nfaces(); i++) {
-        const Vec3f& v0 = wall->vert(wall->face(i)[0]);
-        const Vec3f& v1 = wall->vert(wall->face(i)[1]);
-        const Vec3f& v2 = wall->vert(wall->face(i)[2]);
-
-        const Vec3f& v0N = wall->vnorms(wall->vNorms(i)[0]);
-        const Vec3f& v1N = wall->vnorms(wall->vNorms(i)[1]);
-        const Vec3f& v2N = wall->vnorms(wall->vNorms(i)[2]);
-
-        const Vec2f& UVu = wall->vt(wall->uvs(i)[0]);
-        const Vec2f& UVy = wall->vt(wall->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, mat_diffuse));
-    }
-    ////loading floor
-    mat_diffuse = make_shared<lambertian>(Colour(0.5, 0.5, 0.5));
-    for (uint32_t i = 0; i < floor->nfaces(); i++) {
-        const Vec3f& v0 = floor ->vert(floor->face(i)[0]);
-        const Vec3f& v1 = floor->vert(floor->face(i)[1]);
-        const Vec3f& v2 = floor->vert(floor->face(i)[2]);
-
-        const Vec3f& v0N = floor->vnorms(floor->vNorms(i)[0]);
-        const Vec3f& v1N = floor->vnorms(floor->vNorms(i)[1]);
-        const Vec3f& v2N = floor->vnorms(floor->vNorms(i)[2]);
-
-        const Vec2f& UVu = floor->vt(floor->uvs(i)[0]);
-        const Vec2f& UVy = floor->vt(floor->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, mat_diffuse));
-    }
-    ////loading flower
-    mat_texture = make_shared<image_texture>("qlCc6_4K_Albedo.jpg");
-    mat_diffuse = make_shared<lambertian>(mat_texture);
-    for (uint32_t i = 0; i < flower->nfaces(); i++) {
-        const Vec3f& v0 = flower->vert(flower->face(i)[0]);
-        const Vec3f& v1 = flower->vert(flower->face(i)[1]);
-        const Vec3f& v2 = flower->vert(flower->face(i)[2]);
-
-        const Vec3f& v0N = flower->vnorms(flower->vNorms(i)[0]);
-        const Vec3f& v1N = flower->vnorms(flower->vNorms(i)[1]);
-        const Vec3f& v2N = flower->vnorms(flower->vNorms(i)[2]);
-
-        const Vec2f& UVu = flower->vt(flower->uvs(i)[0]);
-        const Vec2f& UVy = flower->vt(flower->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, mat_diffuse));
-    }
-    ////loading arealight
-    auto light_diffuse = make_shared<diffuse_light>(Colour(255,255,255));
-    for (uint32_t i = 0; i < areaLight->nfaces(); i++) {
-        const Vec3f& v0 = areaLight->vert(areaLight->face(i)[0]);
-        const Vec3f& v1 = areaLight->vert(areaLight->face(i)[1]);
-        const Vec3f& v2 = areaLight->vert(areaLight->face(i)[2]);
-
-        const Vec3f& v0N = areaLight->vnorms(areaLight->vNorms(i)[0]);
-        const Vec3f& v1N = areaLight->vnorms(areaLight->vNorms(i)[1]);
-        const Vec3f& v2N = areaLight->vnorms(areaLight->vNorms(i)[2]);
-
-        const Vec2f& UVu = areaLight->vt(areaLight->uvs(i)[0]);
-        const Vec2f& UVy = areaLight->vt(areaLight->uvs(i)[1]);
-
-        world.add(make_shared<triangle>(v0 + transform, v1 + transform, v2 + transform, v0N, v1N, v2N,UVu,UVy, light_diffuse));
-    }
-    return hittable_list(make_shared<bvh_node>(world)); //with bvh
-}
-
 int main(int argc, char **argv)
 {
+    //renders once without opening a window, see batch.h
+    if (wants_batch(argc, argv)) return batch_main(argc, argv);
+
     // initialise SDL2
     init();
 
@@ -325,23 +161,66 @@ int main(int argc, char **argv)
     const int image_height = static_cast<int>(image_width / aspect_ratio);
     const int max_depth = 50;
 
-    //samples for testing
-    const int spp =10;
-    const float scale = 1.0f / spp;
-
-    //camera (should be in main.ccp)
-
-    Point3f lookfrom(31, 40, 29);
-    Point3f lookat(0, 25, 8);
-    Vec3f vup(0, 1, 0);
-    auto dist_to_focus = (lookfrom - lookat).length();
-    auto aperture = 0.05;
-    camera cam(lookfrom,lookat,vup,35,aspect_ratio,aperture, dist_to_focus);
-
-    //world
-    hittable_list world;
-
-    world = test_scene();
+    //samples for testing, --spp N changes it
+    int spp =10;
+
+    //world and camera
+    scene_setup setup = test_scene();
+    scene& world = setup.world;
+    camera cam = setup.make_camera(aspect_ratio);
+
+    //--heatmaps also writes per pixel node visits, triangle tests, path depth and time as false colour tgas
+    //--wavefront renders each frame in batched stages instead of one recursive path per sample,
+    //--sort-rays also reorders its bounced rays for coherence, --stream-rays intersects them as ray streams
+    //--frame-budget ms renders each frame for that long and picks the spp itself, see budget.h
+    //--temporal reuses the samples of earlier frames where the camera still sees the same surface, see temporal.h
+    //--denoise filters full resolution frames guided by their albedo, normals and depth, see denoise.h
+    bool wavefront = false;
+    bool heatmaps = false;
+    bool sort_rays = false;
+    bool stream_rays = false;
+    double frame_budget = 0;
+    bool temporal = false;
+    bool denoised = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--wavefront") == 0) wavefront = true;
+        if (strcmp(argv[i], "--heatmaps") == 0) heatmaps = true;
+        if (strcmp(argv[i], "--sort-rays") == 0) sort_rays = true;
+        if (strcmp(argv[i], "--stream-rays") == 0) stream_rays = true;
+        if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) spp = std::max(1, atoi(argv[++i]));
+        if (strcmp(argv[i], "--temporal") == 0) temporal = true;
+        if (strcmp(argv[i], "--denoise") == 0) denoised = true;
+        if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) frame_budget = std::max(0.0, atof(argv[++i]));
+    }
+    wavefront_renderer stages(image_width, image_height, spp, max_depth);
+    stages.sort_secondary = sort_rays;
+    stages.stream_extend = stream_rays;
+    std::vector<Colour> framebuffer;
+    std::vector<uint32_t> samples;
+    //the budgeted passes go tile by tile through the classic path, so they leave out the other modes
+    if (frame_budget > 0 && (wavefront || heatmaps)) {
+        std::cerr << "--frame-budget renders without --wavefront and --heatmaps" << std::endl;
+        wavefront = false;
+        heatmaps = false;
+    }
+    if ((temporal || denoised) && (wavefront || frame_budget > 0)) {
+        std::cerr << "--temporal and --denoise are only available without --wavefront and --frame-budget" << std::endl;
+        temporal = false;
+        denoised = false;
+    }
+    temporal_frame history_frame;
+    temporal_history history;
+    feature_buffers features;
+    history_frame.resize(image_width, screen->h, temporal);
+    history_frame.spp = spp;
+    ThreadPool workers(std::thread::hardware_concurrency());
+    //the heatmaps need a pixel to be finished on one thread, which the wavefront stages do not do
+    if (heatmaps && wavefront) {
+        std::cerr << "--heatmaps is only available without --wavefront" << std::endl;
+        heatmaps = false;
+    }
+    aov_buffers aov;
+    if (heatmaps) aov.resize(image_width, screen->h);
 
     const Colour white(255, 255, 255);
     const Colour black(0, 0, 0);
@@ -350,62 +229,154 @@ int main(int argc, char **argv)
     double t;
     Colour pix_col(black);
 
+    //per frame work counters, one json object per line
+    std::ofstream stats_file("render_stats.jsonl");
+    render_counter_registry::instance().collect();
+    int frame = 0;
+
+    //the arrow keys turn and move the camera. after every move the frame comes back at 1/8, 1/4 and 1/2
+    //resolution with one spp before the full one, and a move part way through a frame cancels the rest of it
+    int preview_scale = 8;
+    std::atomic<bool> cancel(false);
+    bool camera_moved = false;
+
     SDL_Event e;
     bool running = true;
+    auto handle_event = [&](const SDL_Event& event) {
+        if (event.type != SDL_KEYDOWN) return;
+        switch (event.key.keysym.sym) {
+        case SDLK_ESCAPE: running = false; break;
+        case SDLK_LEFT: setup.orbit(-5); camera_moved = true; break;
+        case SDLK_RIGHT: setup.orbit(5); camera_moved = true; break;
+        case SDLK_UP: setup.dolly(0.9); camera_moved = true; break;
+        case SDLK_DOWN: setup.dolly(1.0 / 0.9); camera_moved = true; break;
+        }
+        if (camera_moved || !running) cancel = true;
+    };
+    auto t_animation = std::chrono::high_resolution_clock::now();
     while (running) {
 
         auto t_start = std::chrono::high_resolution_clock::now();
 
+        animate_scene(world, std::chrono::duration<float>(t_start - t_animation).count());
+
         // clear back buffer, pixel data on surface and depth buffer (as movement)
         SDL_FillRect(screen, nullptr, SDL_MapRGB(screen->format, 0, 0, 0));
         SDL_RenderClear(renderer);
 
+        int scale = preview_scale;
+        cancel = false;
+        if (wavefront && scale == 1) {
+            t_start = std::chrono::high_resolution_clock::now();
+            stages.seed = frame;
+            stages.render(world, cam, framebuffer);
+            for (int y = 0; y < screen->h; y++)
+                for (int x = 0; x < screen->w; x++)
+                    put_colour(screen, x, y, framebuffer[y * image_width + x], spp);
+            const wavefront_timings& st = stages.timings;
+            std::cerr << "Wavefront generate: " << st.generate << " ms sort: " << st.sort << " ms extend: " << st.extend << " ms shade: " << st.shade
+                << " ms accumulate: " << st.accumulate << " ms (" << st.rays << " rays, " << st.bounces << " bounces)" << std::endl;
+        }
+        else if (frame_budget > 0 && scale == 1) {
+            t_start = std::chrono::high_resolution_clock::now();
+            render_settings settings;
+            settings.width = image_width;
+            settings.height = screen->h;
+            settings.max_depth = max_depth;
+            settings.seed = uint64_t(frame) << 16;
+            budget_report report = render_within(world, cam, settings, frame_budget, workers, framebuffer, samples);
+            for (int y = 0; y < screen->h; y++) {
+                for (int x = 0; x < screen->w; x++) {
+                    size_t i = size_t(y) * image_width + x;
+                    put_colour(screen, x, y, samples[i] > 0 ? framebuffer[i] : black, std::max(1u, samples[i]));
+                }
+            }
+            std::cerr << "Budget: " << report.passes << " passes, " << report.min_spp << " to " << report.max_spp << " spp, "
+                << report.ms_per_spp << " ms per spp" << (report.cut ? ", last pass stopped at the deadline" : "") << std::endl;
+        }
         /* source from Ryan Westwood starts here*/
-        {
+        else {
             t_start = std::chrono::high_resolution_clock::now();
-            ThreadPool pool(std::thread::hardware_concurrency());
-
-            int start = screen->h - 1;
-            int step = screen->h / std::thread::hardware_concurrency();
-            for (int y = 0; y < screen->h - 1; y++) {
-                pool.Enqueue(std::bind(lineRender, screen, world, y, spp, max_depth, &cam));
+            std::atomic<int> rows_left(0);
+            for (int y = 0; y < screen->h; y += scale) {
+                rows_left++;
+                workers.Enqueue([&, y] {
+                    lineRender(screen, world, y, spp, max_depth, &cam, heatmaps && scale == 1 ? &aov : nullptr, uint64_t(frame), scale, &cancel,
+                        (temporal || denoised) && scale == 1 ? &history_frame : nullptr);
+                    rows_left--;
+                });
+            }
+            //keeps taking events while the rows render, so a camera move can stop them
+            while (rows_left > 0) {
+                if (SDL_PollEvent(&e)) handle_event(e);
+                else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if ((temporal || denoised) && scale == 1 && !cancel) {
+                float samples_behind = float(spp);
+                if (temporal) {
+                    history.resolve(cam, history_frame, framebuffer);
+                    samples_behind = history.mean_samples;
+                    std::cerr << "Temporal: " << history.reused * 100 << "% of pixels reused" << std::endl;
+                }
+                else {
+                    framebuffer.resize(history_frame.sums.size());
+                    for (size_t i = 0; i < framebuffer.size(); i++) framebuffer[i] = history_frame.sums[i] / float(spp);
+                }
+                //the history keeps the noisy means, only what is shown is filtered
+                if (denoised) {
+                    auto t_filter = std::chrono::high_resolution_clock::now();
+                    features.render(world, cam, image_width, screen->h, workers);
+                    denoise(framebuffer, features, denoise_settings(), samples_behind, workers, framebuffer);
+                    std::cerr << "Denoise: " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_filter).count() << " ms" << std::endl;
+                }
+                for (int y = 0; y < screen->h; y++)
+                    for (int x = 0; x < screen->w; x++)
+                        put_colour(screen, x, y, framebuffer[size_t(y) * image_width + x], 1);
             }
         }
         /*Source from Ryan Westwood ends here*/ 
         auto t_end = std::chrono::high_resolution_clock::now();
         auto passedTime = std::chrono::duration<double, std::milli>(t_end - t_start).count();
-        std::cerr << "Frame render time:  " << passedTime << " ms" << std::endl;
-
-        image.flip_vertically();
-        image.write_tga_file("raytracer_renderer.tga");
+        bool cancelled = cancel;
+        std::cerr << (scale > 1 ? "Preview 1/" + std::to_string(scale) + " render time: " : "Frame render time:  ") << passedTime << " ms"
+            << (cancelled ? " (cancelled)" : "") << std::endl;
+        write_frame_json(stats_file, frame++, passedTime, render_counter_registry::instance().collect());
+
+        //the tga and heatmaps only get finished full resolution frames
+        if (scale == 1 && !cancelled) {
+            image.flip_vertically();
+            image.write_tga_file("raytracer_renderer.tga");
+            if (heatmaps) aov.write("raytracer_renderer");
+        }
 
 
 
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, screen);
-        if (texture == NULL) {
-            fprintf(stderr, "CreateTextureFromSurface failed: %s\n", SDL_GetError());
-            exit(1);
-        }
-        SDL_FreeSurface(screen);
+        //a cancelled frame is half drawn, the window keeps the last whole one
+        if (!cancelled) {
+            SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, screen);
+            if (texture == NULL) {
+                fprintf(stderr, "CreateTextureFromSurface failed: %s\n", SDL_GetError());
+                exit(1);
+            }
+            SDL_FreeSurface(screen);
 
-        SDL_RenderCopyEx(renderer, texture, nullptr, nullptr,0,0,SDL_FLIP_VERTICAL);
-        SDL_RenderPresent(renderer);
+            SDL_RenderCopyEx(renderer, texture, nullptr, nullptr,0,0,SDL_FLIP_VERTICAL);
+            SDL_RenderPresent(renderer);
 
-        SDL_DestroyTexture(texture);
+            SDL_DestroyTexture(texture);
+        }
 
-        if (SDL_PollEvent(&e))
-        {
-            switch (e.type) {
-            case SDL_KEYDOWN:
-                switch (e.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    running = false;
-                    break;
-                }
-                break;
-            }
+        while (SDL_PollEvent(&e)) handle_event(e);
+        if (camera_moved) {
+            cam = setup.make_camera(aspect_ratio);
+            camera_moved = false;
+            preview_scale = 8;
+        }
+        else if (preview_scale > 1) {
+            preview_scale /= 2;
         }
     }
 
     return 0;
 }
+#endif
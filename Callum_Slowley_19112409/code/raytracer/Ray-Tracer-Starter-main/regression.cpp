@@ -0,0 +1,160 @@
+// Renders a fixed set of scenes with a fixed seed and compares them to the reference images in
+// regression/, so a change that makes the renderer faster by making the image wrong is caught.
+// timings, rays per second and image error go to a json report to track from commit to commit.
+// see README.md for the build command, the binary is run_regression so it does not clash with the directory.
+//
+// usage: run_regression [--update] [--threads N] [--seed N] [--filter text] [--report file]
+//   --update  writes the current renders as the new references instead of comparing
+//   --seed    renders with another random stream, to check the limits still pass on noise alone
+
+#include "common.h"
+#include "scenes.h"
+#include "render.h"
+#include "counters.h"
+#include "rtw_stb_image.h"
+#include "tgaimage.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// a scene at fixed settings and how far its render may drift from the reference.
+// the limits sit above the noise of a render with a different random stream, so reordering
+// the random numbers passes but a missing bounce, a wrong material or lost geometry does not
+struct regression_case {
+	const char* scene;
+	int width, height, spp, max_depth;
+	double max_rmse;
+};
+
+static const regression_case cases[] = {
+	{ "test", 160, 90, 16, 50, 12.0 },
+	{ "spheres", 160, 90, 16, 50, 4.0 },
+	{ "dandelions", 160, 90, 8, 50, 8.0 },
+};
+
+struct image_error {
+	double rmse = 0;
+	double psnr = 0;
+	double max_difference = 0;
+};
+
+// over the 8 bit channels of two images of the same size
+static image_error compare_images(TGAImage& a, TGAImage& b) {
+	image_error error;
+	double sum = 0;
+	size_t n = 0;
+	for (int y = 0; y < a.get_height(); y++) {
+		for (int x = 0; x < a.get_width(); x++) {
+			TGAColor ca = a.get(x, y), cb = b.get(x, y);
+			for (int c = 0; c < 3; c++) {
+				double d = double(ca.raw[c]) - double(cb.raw[c]);
+				sum += d * d;
+				error.max_difference = std::max(error.max_difference, std::fabs(d));
+				n++;
+			}
+		}
+	}
+	error.rmse = n ? sqrt(sum / n) : 0;
+	//identical images have no finite psnr and json has no infinity
+	error.psnr = error.rmse > 0 ? 20 * log10(255.0 / error.rmse) : 99.0;
+	return error;
+}
+
+int main(int argc, char** argv) {
+	bool update = false;
+	std::string filter;
+	std::string report_name = "regression_report.json";
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t seed = render_settings().seed;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--update") == 0) update = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+		else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) report_name = argv[++i];
+		else {
+			std::cerr << "unknown argument " << argv[i] << std::endl;
+			std::cerr << "usage: run_regression [--update] [--threads N] [--seed N] [--filter text] [--report file]" << std::endl;
+			return 2;
+		}
+	}
+
+	std::ofstream report(report_name);
+	report << "{\"threads\":" << threads << ",\"seed\":" << seed << ",\"cases\":[";
+	int failures = 0;
+	bool first = true;
+	for (const regression_case& test : cases) {
+		if (!filter.empty() && std::string(test.scene).find(filter) == std::string::npos) continue;
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		//the bvh builds pick split axes at random, seeded too so the trees are the same every run
+		seed_random(seed);
+		scene_setup setup;
+		make_scene(test.scene, setup);
+		animate_scene(setup.world, 0);
+		auto t1 = std::chrono::high_resolution_clock::now();
+
+		render_settings settings;
+		settings.width = test.width;
+		settings.height = test.height;
+		settings.spp = test.spp;
+		settings.max_depth = test.max_depth;
+		settings.threads = threads;
+		settings.seed = seed;
+		camera cam = setup.make_camera(double(test.width) / test.height);
+		std::vector<Colour> framebuffer;
+		render_counter_registry::instance().collect();
+		auto t2 = std::chrono::high_resolution_clock::now();
+		render_image(setup.world, cam, settings, framebuffer);
+		auto t3 = std::chrono::high_resolution_clock::now();
+
+		render_counters total;
+		for (const auto& t : render_counter_registry::instance().collect()) total.add(t);
+		double build_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+		double render_ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+		double rays = static_cast<double>(total.primary_rays + total.secondary_rays + total.shadow_rays);
+		double rays_per_second = render_ms > 0 ? rays * 1000.0 / render_ms : 0;
+
+		TGAImage image = to_image(framebuffer, test.width, test.height, test.spp);
+		std::string reference_name = std::string("regression/") + test.scene + ".tga";
+		std::string render_name = std::string("regression_") + test.scene + ".tga";
+		image.write_tga_file(render_name.c_str());
+
+		const char* status = "pass";
+		image_error error;
+		if (update) {
+			status = image.write_tga_file(reference_name.c_str()) ? "updated" : "fail";
+		}
+		else {
+			TGAImage reference;
+			if (!reference.read_tga_file(reference_name.c_str())) status = "missing";
+			else if (reference.get_width() != image.get_width() || reference.get_height() != image.get_height()) status = "fail";
+			else {
+				error = compare_images(image, reference);
+				if (error.rmse > test.max_rmse) status = "fail";
+			}
+		}
+		if (strcmp(status, "pass") != 0 && strcmp(status, "updated") != 0) failures++;
+
+		printf("%-12s %-8s build %8.1f ms  render %9.1f ms  %8.3f Mrays/s  rmse %6.3f (max %5.2f)  psnr %6.2f dB\n", test.scene, status,
+			build_ms, render_ms, rays_per_second / 1e6, error.rmse, test.max_rmse, error.psnr);
+
+		report << (first ? "" : ",") << "\n{\"scene\":\"" << test.scene << "\",\"status\":\"" << status << "\",\"width\":" << test.width
+			<< ",\"height\":" << test.height << ",\"spp\":" << test.spp << ",\"max_depth\":" << test.max_depth
+			<< ",\"build_ms\":" << build_ms << ",\"render_ms\":" << render_ms << ",\"rays_per_second\":" << rays_per_second
+			<< ",\"rmse\":" << error.rmse << ",\"max_rmse\":" << test.max_rmse << ",\"psnr\":" << error.psnr
+			<< ",\"max_difference\":" << error.max_difference << ",\"counters\":";
+		total.write_json(report);
+		report << "}";
+		first = false;
+	}
+	report << "\n],\"failures\":" << failures << "}" << std::endl;
+
+	//non zero so a script or ci job can stop on it
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include "counters.h"
+#include "Multithreading.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// the path tracing the window and the command line tools share, without anything from SDL
+
+Colour ray_colour(const Ray& r, const Colour& background, const scene& world, int depth) {
+	hit_record rec;
+	//if we have hit the depth limit no more light has been gathered
+	if (depth <= 0) return Colour(0, 0, 0);
+	if (!world.hit(r, 0.001, infinity, rec)) { return background; }
+	rec.finalize(r);
+	Ray scattered;
+	Colour attenuation;
+	Colour emitted = world.materials.emitted(rec.mat_id);
+	if (!world.materials.scatter(rec.mat_id, r, rec, attenuation, scattered))
+		return emitted;
+	if (depth > 1) counters().secondary_rays++;
+	return attenuation * ray_colour(scattered, background, world, depth - 1);
+}
+
+// white at the horizon to blue straight up, picked once from the camera ray and used for every bounce
+inline Colour sky_colour(const Ray& camera_ray) {
+	Vec3f unit_direction = camera_ray.unit_direction();
+	auto t = 0.5 * (unit_direction.y + 1.0);
+	return (1.0 - t) * Colour(1.0, 1.0, 1.0) + t * Colour(0.5, 0.7, 1.0) * 255;
+}
+
+// sum of spp samples for pixel x,y of a width by height image. the generator is seeded from seed and
+// the pixel first, so a pixel comes out the same whichever thread renders it and in whatever order
+inline Colour render_pixel(const scene& world, const camera& cam, int x, int y, int width, int height, int spp, int max_depth, uint64_t seed) {
+	seed_random((seed << 32) ^ (uint64_t(y) * width + x));
+	counters().primary_rays += spp;
+	Colour pix_col(0, 0, 0);
+	for (int s = 0; s < spp; s++) {
+		auto u = double(x + random_double()) / (width - 1);
+		auto v = double(y + random_double()) / (height - 1);
+		Ray ray = cam.get_ray(u, v);
+		//colours for every sample
+		pix_col = pix_col + ray_colour(ray, sky_colour(ray), world, max_depth);
+	}
+	return pix_col;
+}
+
+// scale by spp and gamma correct a sum from render_pixel, 0 to 255 per channel
+inline Colour display_colour(Colour pix_col, int spp) {
+	pix_col /= 255.f * spp;
+	pix_col.x = sqrt(std::max(0.0f, pix_col.x));
+	pix_col.y = sqrt(std::max(0.0f, pix_col.y));
+	pix_col.z = sqrt(std::max(0.0f, pix_col.z));
+	pix_col *= 255;
+	pix_col.x = std::min(255.0f, pix_col.x);
+	pix_col.y = std::min(255.0f, pix_col.y);
+	pix_col.z = std::min(255.0f, pix_col.z);
+	return pix_col;
+}
+
+struct render_settings {
+	int width = 160;
+	int height = 90;
+	int spp = 16;
+	int max_depth = 50;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t seed = 1;
+};
+
+// framebuffer gets width*height sums from render_pixel, rows shared out over pool.
+// returns once every row is done, so one pool can stay up for many renders
+void render_image(const scene& world, const camera& cam, const render_settings& settings, std::vector<Colour>& framebuffer, ThreadPool& pool) {
+	framebuffer.assign(size_t(settings.width) * settings.height, Colour(0, 0, 0));
+	std::mutex mutex;
+	std::condition_variable finished;
+	int rows_left = settings.height;
+	for (int y = 0; y < settings.height; y++) {
+		pool.Enqueue([&, y] {
+			for (int x = 0; x < settings.width; x++)
+				framebuffer[size_t(y) * settings.width + x] = render_pixel(world, cam, x, y, settings.width, settings.height, settings.spp, settings.max_depth, settings.seed);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--rows_left == 0) finished.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&rows_left] { return rows_left == 0; });
+}
+
+// the same on a pool of settings.threads made for this render
+void render_image(const scene& world, const camera& cam, const render_settings& settings, std::vector<Colour>& framebuffer) {
+	ThreadPool pool(static_cast<short>(std::max(1, settings.threads)));
+	render_image(world, cam, settings, framebuffer, pool);
+}
+
+// the framebuffer as the window shows it, row 0 at the bottom like the tga the window writes
+inline TGAImage to_image(const std::vector<Colour>& framebuffer, int width, int height, int spp) {
+	TGAImage image(width, height, TGAImage::RGB);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			Colour c = display_colour(framebuffer[size_t(y) * width + x], spp);
+			image.set(x, y, TGAColor(static_cast<unsigned char>(c.x), static_cast<unsigned char>(c.y), static_cast<unsigned char>(c.z), 255));
+		}
+	}
+	image.flip_vertically();
+	return image;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Renders one still with several headless raytracer processes on this machine, one thread each,
+# every process taking an interleaved share of the tiles, then merges the parts.
+# build raytracer and merge first, see README.md.
+#
+# usage: ./render_distributed.sh workers [raytracer arguments, e.g. --width 1920 --height 1080 --spp 64]
+# RAYTRACER and MERGE override where the programs are, OUTPUT where the image goes.
+
+set -e
+workers=${1:?usage: render_distributed.sh workers [raytracer arguments]}
+shift
+raytracer=${RAYTRACER:-./raytracer}
+merge=${MERGE:-./merge}
+output=${OUTPUT:-raytracer_renderer.tga}
+parts=$(mktemp -d)
+trap 'rm -rf "$parts"' EXIT
+
+start=$(date +%s.%N)
+i=0
+pids=""
+while [ "$i" -lt "$workers" ]; do
+	"$raytracer" --headless "$@" --threads 1 --tiles "$i/$workers" --partial "$parts/$i.part" > "$parts/$i.json" 2> "$parts/$i.log" &
+	pids="$pids $!"
+	i=$((i + 1))
+done
+for pid in $pids; do
+	if ! wait "$pid"; then
+		cat "$parts"/*.log >&2
+		exit 1
+	fi
+done
+rendered=$(date +%s.%N)
+#merge reports each part and any problem on stderr, and a failure stops the script through set -e
+"$merge" --output "$output" "$parts"/*.part
+done_at=$(date +%s.%N)
+
+#wall time includes every process loading the scene, the slowest worker's render time is what tiling can speed up
+slowest=$(cat "$parts"/*.json | sed 's/.*"render_ms":\([0-9.e+]*\).*/\1/' | sort -g | tail -n 1)
+awk -v w="$workers" -v s="$start" -v r="$rendered" -v d="$done_at" -v slow="$slowest" -v out="$output" \
+	'BEGIN { printf "%d workers: wall %.3f s, slowest render %.3f s, merge %.3f s, written to %s\n", w, r - s, slow / 1000, d - r, out }'
+
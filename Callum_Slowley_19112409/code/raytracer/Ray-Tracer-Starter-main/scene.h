@@ -0,0 +1,139 @@
+#pragma once
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "model.h"
+#include "triangles.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "instance.h"
+#include "dynamic_mesh.h"
+#include <map>
+#include <string>
+#include <tuple>
+
+// two level acceleration structure. every obj file gets one bottom level bvh built in object space,
+// the top level bvh only covers the instances so moving a model just needs commit() again
+class scene : public hittable {
+public:
+	scene() {}
+
+	// bottom level bvh for an obj file, loaded once per material and build options and shared by every instance of it
+	shared_ptr<hittable> load_mesh(const char* filename, int mat, const bvh_build_options& options = bvh_build_options());
+	// a mesh with its own copy of the triangles so it can be deformed, see dynamic_mesh
+	shared_ptr<dynamic_mesh> load_dynamic_mesh(const char* filename, int mat, const bvh_build_options& options = bvh_build_options());
+	shared_ptr<instance> add_instance(shared_ptr<hittable> mesh, const Matrix44f& object_to_world = Matrix44f());
+	void add(shared_ptr<hittable> object);
+
+	// rebuilds the top level, call after adding instances or changing their transforms
+	void commit();
+	// updates the top level bounds after dynamic meshes have been deformed
+	void refit();
+
+	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override;
+	// a shadow ray, stops at the first thing found between t_min and t_max
+	virtual bool occluded(const Ray& r, double t_min, double t_max) const override {
+		counters().shadow_rays++;
+		return top && top->occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(aabb& output_box) const override;
+	virtual void hit_stream_subset(const ray_stream& rays, uint32_t* ids, size_t count, hit_stream& hits) const override {
+		if (top) top->hit_stream_subset(rays, ids, count, hits);
+	}
+
+public:
+	std::vector<shared_ptr<instance>> instances;
+	hittable_list objects; // anything placed directly in world space, e.g. spheres
+	material_table materials;
+	std::vector<shared_ptr<dynamic_mesh>> animated;
+
+private:
+	std::map<std::tuple<std::string, int, std::string>, shared_ptr<hittable>> meshes; // by file, material and options key
+	shared_ptr<hittable> top;
+};
+
+// every face of an obj file as a triangle in object space
+inline hittable_list load_triangles(const char* filename, int mat) {
+	Model model(filename);
+	hittable_list mesh;
+	for (uint32_t i = 0; i < model.nfaces(); i++) {
+		const Vec3f& v0 = model.vert(model.face(i)[0]);
+		const Vec3f& v1 = model.vert(model.face(i)[1]);
+		const Vec3f& v2 = model.vert(model.face(i)[2]);
+
+		const Vec3f& v0N = model.vnorms(model.vNorms(i)[0]);
+		const Vec3f& v1N = model.vnorms(model.vNorms(i)[1]);
+		const Vec3f& v2N = model.vnorms(model.vNorms(i)[2]);
+
+		const Vec2f& UVu = model.vt(model.uvs(i)[0]);
+		const Vec2f& UVy = model.vt(model.uvs(i)[1]);
+
+		mesh.add(make_shared<triangle>(v0, v1, v2, v0N, v1N, v2N, UVu, UVy, mat));
+	}
+	return mesh;
+}
+
+shared_ptr<hittable> scene::load_mesh(const char* filename, int mat, const bvh_build_options& options) {
+	auto key = std::make_tuple(std::string(filename), mat, options.key());
+	auto found = meshes.find(key);
+	if (found != meshes.end()) return found->second;
+
+	hittable_list mesh = load_triangles(filename, mat);
+	shared_ptr<hittable> blas;
+	if (!mesh.objects.empty()) {
+		auto bvh = make_shared<bvh_node>(mesh, options);
+		bvh->stats().print(std::cerr, filename);
+		if (options.compress) blas = make_shared<compressed_bvh>(*bvh);
+		else blas = bvh;
+	}
+	meshes[key] = blas;
+	return blas;
+}
+
+shared_ptr<dynamic_mesh> scene::load_dynamic_mesh(const char* filename, int mat, const bvh_build_options& options) {
+	hittable_list mesh = load_triangles(filename, mat);
+	if (mesh.objects.empty()) return nullptr;
+	auto dynamic = make_shared<dynamic_mesh>(mesh, options);
+	dynamic->bvh->stats().print(std::cerr, filename);
+	animated.push_back(dynamic);
+	return dynamic;
+}
+
+shared_ptr<instance> scene::add_instance(shared_ptr<hittable> mesh, const Matrix44f& object_to_world) {
+	//a mesh that failed to load has nothing to place
+	if (!mesh) return nullptr;
+	auto inst = make_shared<instance>(mesh, object_to_world);
+	instances.push_back(inst);
+	return inst;
+}
+
+void scene::add(shared_ptr<hittable> object) {
+	objects.add(object);
+}
+
+void scene::commit() {
+	hittable_list list;
+	for (const auto& inst : instances) list.add(inst);
+	for (const auto& object : objects.objects) list.add(object);
+
+	if (list.objects.empty()) {
+		top = nullptr;
+		return;
+	}
+	auto root = make_shared<bvh_node>(list);
+	root->stats().print(std::cerr, "top level");
+	top = root;
+}
+
+void scene::refit() {
+	if (top) top->refit();
+}
+
+bool scene::hit(const Ray& r, double t_min, double t_max, hit_record& rec) const {
+	return top && top->hit(r, t_min, t_max, rec);
+}
+
+bool scene::bounding_box(aabb& output_box) const {
+	return top && top->bounding_box(output_box);
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "material.h"
+#include "sphere.h"
+#include "instance.h"
+#include "scene.h"
+#include "Texture.h"
+#include <string>
+
+// the scenes the window and the command line tools can render, each with the view it is meant to be seen from
+struct scene_setup {
+	scene world;
+	Point3f lookfrom, lookat;
+	double vfov = 35;
+	double aperture = 0.05;
+
+	camera make_camera(double aspect_ratio) const {
+		return camera(lookfrom, lookat, Vec3f(0, 1, 0), vfov, aspect_ratio, aperture, (lookfrom - lookat).length());
+	}
+
+	// turns lookfrom around the vertical line through lookat
+	void orbit(double degrees) {
+		double a = degrees_to_radians(degrees);
+		Vec3f d = lookfrom - lookat;
+		lookfrom = lookat + Vec3f(static_cast<float>(d.x * cos(a) - d.z * sin(a)), d.y, static_cast<float>(d.x * sin(a) + d.z * cos(a)));
+	}
+
+	// moves lookfrom along the line to lookat, below 1 gets closer
+	void dolly(double factor) {
+		lookfrom = lookat + (lookfrom - lookat) * static_cast<float>(factor);
+	}
+};
+
+// the table with the mirror, the glass ball, the water and the dandelion
+scene_setup test_scene() {
+	scene_setup setup;
+	scene& world = setup.world;
+	//each model is stored once in object space and placed with an instance transform
+	auto transform = translation(Vec3f(0, 0, 0));
+	//only the top of each mesh bvh is built up front, the render threads build the rest as rays reach it
+	bvh_build_options blas;
+	blas.lazy = true;
+
+	//loading table model
+	int mat_diffuse = world.materials.add(lambertian(make_shared<image_texture>("TableUvs.jpg")));
+	world.add_instance(world.load_mesh("Table.obj", mat_diffuse, blas), transform);
+	////loading table handel
+	int metal_diffuse = world.materials.add(metal(Colour(0, 0, 0), 0));
+	world.add_instance(world.load_mesh("Handle.obj", metal_diffuse, blas), transform);
+	////loading mirror
+	mat_diffuse = world.materials.add(lambertian(Colour(0, 1, 1)));
+	world.add_instance(world.load_mesh("Mirror.obj", mat_diffuse, blas), transform);
+	////loading mirrorinner
+	metal_diffuse = world.materials.add(metal(Colour(.5, .5, .5), 0));
+	world.add_instance(world.load_mesh("MirrorInner.obj", metal_diffuse, blas), transform);
+	////loading glass ball
+	int glass_diffuse = world.materials.add(dielectric(1.5));
+	world.add_instance(world.load_mesh("Water.obj", glass_diffuse, blas), transform);
+	////loading water, deformed every frame so it gets a refittable mesh of its own
+	int water_mat = world.materials.add(Water(1.3));
+	world.add_instance(world.load_dynamic_mesh("WaterBall.obj", water_mat, blas), transform);
+	//////loading wall
+	mat_diffuse = world.materials.add(lambertian(Colour(0.5, 0.5, 0.5)));
+	world.add_instance(world.load_mesh("Wall.obj", mat_diffuse, blas), transform);
+	////loading floor
+	world.add_instance(world.load_mesh("Floor.obj", mat_diffuse, blas), transform);
+	////loading flower, the long thin stems overlap badly so let the bvh split them spatially
+	auto mat_texture = make_shared<image_texture>("qlCc6_4K_Albedo.jpg");
+	mat_diffuse = world.materials.add(lambertian(mat_texture));
+	bvh_build_options stems = blas;
+	stems.split_mode = bvh_split_mode::spatial;
+	world.add_instance(world.load_mesh("Damdelion.obj", mat_diffuse, stems), transform);
+	////loading arealight
+	int light_diffuse = world.materials.add(diffuse_light(Colour(255, 255, 255)));
+	world.add_instance(world.load_mesh("AreaLight.obj", light_diffuse, blas), transform);
+
+	world.commit();
+	setup.lookfrom = Point3f(31, 40, 29);
+	setup.lookat = Point3f(0, 25, 8);
+	return setup;
+}
+
+// analytic spheres only, no meshes, so it shows changes to the sampling and materials on their own
+scene_setup sphere_scene() {
+	scene_setup setup;
+	scene& world = setup.world;
+	int ground = world.materials.add(lambertian(Colour(0.5, 0.5, 0.5)));
+	world.add(make_shared<sphere>(Point3f(0, -1000, 0), 1000, ground));
+
+	int glass = world.materials.add(dielectric(1.5));
+	int matte = world.materials.add(lambertian(Colour(0.4, 0.2, 0.1)));
+	int mirror = world.materials.add(metal(Colour(0.7, 0.6, 0.5), 0.0));
+	world.add(make_shared<sphere>(Point3f(0, 1, 0), 1.0, glass));
+	world.add(make_shared<sphere>(Point3f(-4, 1, 0), 1.0, matte));
+	world.add(make_shared<sphere>(Point3f(4, 1, 0), 1.0, mirror));
+
+	//a ring of small spheres in every material
+	int brushed = world.materials.add(metal(Colour(0.8, 0.8, 0.9), 0.3));
+	int red = world.materials.add(lambertian(Colour(0.8, 0.1, 0.1)));
+	int water = world.materials.add(Water(1.3));
+	int kinds[4] = { brushed, red, water, glass };
+	for (int i = 0; i < 16; i++) {
+		double angle = 2 * pi * i / 16;
+		world.add(make_shared<sphere>(Point3f(7 * cos(angle), 0.3, 7 * sin(angle)), 0.3, kinds[i % 4]));
+	}
+
+	world.commit();
+	setup.lookfrom = Point3f(13, 2, 3);
+	setup.lookat = Point3f(0, 0, 0);
+	setup.vfov = 30;
+	setup.aperture = 0.1;
+	return setup;
+}
+
+// a field of 64 dandelions on the floor, about 63k triangles, for the bvh builds and traversal
+scene_setup dandelion_field() {
+	scene_setup setup;
+	scene& world = setup.world;
+	bvh_build_options blas;
+	blas.split_mode = bvh_split_mode::spatial;
+
+	int floor = world.materials.add(lambertian(Colour(0.5, 0.5, 0.5)));
+	world.add_instance(world.load_mesh("Floor.obj", floor, blas), translation(Vec3f(0, 0, 0)));
+
+	int flower = world.materials.add(lambertian(make_shared<image_texture>("qlCc6_4K_Albedo.jpg")));
+	auto mesh = world.load_mesh("Damdelion.obj", flower, blas);
+	aabb bounds;
+	if (mesh && mesh->bounding_box(bounds)) {
+		//stand each copy on the floor around its own stem, turned so the copies do not all match.
+		//the floor starts at x = -30 so the field is centred further along it
+		Point3f base((bounds.min().x + bounds.max().x) / 2, bounds.min().y, (bounds.min().z + bounds.max().z) / 2);
+		for (int i = 0; i < 8; i++) {
+			for (int j = 0; j < 8; j++) {
+				Vec3f position(40 + (i - 3.5f) * 6, 0.13f, (j - 3.5f) * 6);
+				world.add_instance(mesh, translation(-base) * rotation_y((i * 8 + j) * 47.0) * translation(position));
+			}
+		}
+	}
+
+	world.commit();
+	setup.lookfrom = Point3f(40, 18, 45);
+	setup.lookat = Point3f(40, 2, 0);
+	setup.vfov = 40;
+	return setup;
+}
+
+// the names the command line tools know the scenes by
+const char* const scene_names[] = { "test", "spheres", "dandelions" };
+
+// false if there is no scene called name
+inline bool make_scene(const std::string& name, scene_setup& setup) {
+	if (name == "test") setup = test_scene();
+	else if (name == "spheres") setup = sphere_scene();
+	else if (name == "dandelions") setup = dandelion_field();
+	else return false;
+	return true;
+}
+
+// ripples the water the same way the rasteriser vertex shader does, then refits rather than rebuilds
+inline void animate_scene(scene& world, float seconds) {
+	for (auto& mesh : world.animated) {
+		mesh->deform([seconds](const Point3f& p) { return Point3f(p.x + sinf(p.y * 4 + seconds) / 20, p.y, p.z); });
+	}
+	world.refit();
+}
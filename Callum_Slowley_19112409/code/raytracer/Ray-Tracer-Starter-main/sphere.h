@@ -7,17 +7,18 @@
 class sphere : public hittable {
 public:
 	sphere() {}
-	sphere(Point3f cen, double r,shared_ptr<material> m) : centre(cen), radius(r),mat_ptr(m) {};
+	sphere(Point3f cen, double r, int m) : centre(cen), radius(r), mat_id(m) {};
 
 	virtual bool hit(
 		const Ray& r, double t_min, double t_max, hit_record& rec) const override;
 
 	virtual bool bounding_box(aabb& output_box) const override;
+	virtual void get_surface(const Ray& r, hit_record& rec) const override;
 
 public:
 	Point3f centre;
 	double radius;
-	shared_ptr<material> mat_ptr;
+	int mat_id;
 
 };
 
@@ -40,15 +41,20 @@ bool sphere::hit(const Ray& r, double t_min, double t_max, hit_record& rec) cons
 
 	// Update hit record data accordingly
 	rec.t = root;
+	rec.prim = this;
+	rec.inst = nullptr;
+	rec.mat_id = mat_id;
+
+	return true;
+}
+
+inline void sphere::get_surface(const Ray& r, hit_record& rec) const {
 	rec.p = r.at(rec.t);
 	Vec3f outward_normal = (rec.p - centre) / radius;
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mat_ptr;
-
-	return true;
 }
 
 inline bool sphere::bounding_box(aabb& output_box) const {
-	output_box = aabb(centre - Vec3f(radius, radius, radius), centre + Vec3f(radius, radius, radius));
+	output_box = padded(aabb(centre - Vec3f(radius, radius, radius), centre + Vec3f(radius, radius, radius)));
 	return true;
 }
\ No newline at end of file
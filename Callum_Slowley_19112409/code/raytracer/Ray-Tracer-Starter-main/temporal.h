@@ -0,0 +1,123 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// keeps the samples of earlier frames while the camera moves, so a few spp per frame still adds up.
+// every frame records where each pixel's middle ray first hits. the next frame projects its own hits into
+// the camera of the last one, and a pixel takes the history of the pixel it lands on if that one saw the
+// same surface, anything else was hidden before and starts again. the history is clamped to the colours
+// around the pixel in the new frame, so changed lighting, like the moving water, fades in instead of smearing
+
+// what one frame gives the history, filled in pixel by pixel by the renderer
+struct temporal_frame {
+	int width = 0, height = 0;
+	int spp = 1;
+	std::vector<Colour> sums;        // render_pixel sums
+	std::vector<Point3f> positions;  // first hit of the ray through the middle of the pixel
+	std::vector<uint8_t> hits;       // 0 where that ray saw the sky
+
+	// without positions only the sums are kept, for a frame that is denoised but not reprojected
+	void resize(int w, int h, bool with_positions = true) {
+		width = w;
+		height = h;
+		sums.assign(size_t(w) * h, Colour(0, 0, 0));
+		positions.assign(with_positions ? sums.size() : 0, Point3f(0, 0, 0));
+		hits.assign(positions.size(), 0);
+	}
+
+	// stores sum for pixel x,y of an image_width by image_height render and traces its middle ray.
+	// that ray is not one of the samples, it only finds the surface, so it is left out of the counters
+	void record(const scene& world, const camera& cam, int x, int y, int image_width, int image_height, const Colour& sum) {
+		size_t i = size_t(y) * width + x;
+		sums[i] = sum;
+		if (positions.empty()) return;
+		hit_record rec;
+		Ray r = cam.get_ray((x + 0.5) / (image_width - 1), (y + 0.5) / (image_height - 1));
+		hits[i] = world.hit(r, 0.001, infinity, rec) ? 1 : 0;
+		if (hits[i]) positions[i] = r.at(rec.t);
+	}
+};
+
+class temporal_history {
+public:
+	int max_samples = 256;            // history is weighted as at most this many samples, so old light fades
+	float position_tolerance = 0.02f; // how far apart two hits can be and count as one surface, per unit of depth
+
+	// blends frame, rendered through cam, with the history. resolved gets every pixel's mean as a sum of
+	// one sample, and becomes the history for the next frame
+	void resolve(const camera& cam, const temporal_frame& frame, std::vector<Colour>& resolved);
+
+	// share of the pixels that took history in the last resolve, and the samples behind its means on average
+	float reused = 0;
+	float mean_samples = 0;
+
+private:
+	int width = 0, height = 0;
+	std::unique_ptr<camera> previous;
+	std::vector<Colour> means;
+	std::vector<float> samples;
+	std::vector<Point3f> positions;
+	std::vector<uint8_t> hits;
+};
+
+void temporal_history::resolve(const camera& cam, const temporal_frame& frame, std::vector<Colour>& resolved) {
+	int w = frame.width, h = frame.height;
+	size_t n = size_t(w) * h;
+	bool has_history = previous && width == w && height == h;
+	std::vector<Colour> current(n);
+	for (size_t i = 0; i < n; i++) current[i] = frame.sums[i] / float(frame.spp);
+
+	resolved.resize(n);
+	std::vector<float> new_samples(n);
+	size_t taken = 0;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			size_t i = size_t(y) * w + x;
+			resolved[i] = current[i];
+			new_samples[i] = float(frame.spp);
+			if (!has_history || !frame.hits[i]) continue;
+
+			//where this surface was on screen last frame, u = (x + 0.5) / (width - 1) the other way round
+			double s, t, depth;
+			if (!previous->project(frame.positions[i], s, t, depth)) continue;
+			int px = static_cast<int>(std::floor(s * (w - 1))), py = static_cast<int>(std::floor(t * (h - 1)));
+			if (px < 0 || py < 0 || px >= w || py >= h) continue;
+			size_t j = size_t(py) * w + px;
+			//disoccluded, that pixel saw something else
+			if (!hits[j] || (positions[j] - frame.positions[i]).length() > position_tolerance * depth) continue;
+
+			Colour lo = current[i], hi = current[i];
+			for (int ny = std::max(0, y - 1); ny <= std::min(h - 1, y + 1); ny++) {
+				for (int nx = std::max(0, x - 1); nx <= std::min(w - 1, x + 1); nx++) {
+					const Colour& c = current[size_t(ny) * w + nx];
+					lo = Colour(std::min(lo.x, c.x), std::min(lo.y, c.y), std::min(lo.z, c.z));
+					hi = Colour(std::max(hi.x, c.x), std::max(hi.y, c.y), std::max(hi.z, c.z));
+				}
+			}
+			const Colour& old = means[j];
+			Colour clamped(std::min(std::max(old.x, lo.x), hi.x), std::min(std::max(old.y, lo.y), hi.y), std::min(std::max(old.z, lo.z), hi.z));
+			float weight = std::min(samples[j], float(std::max(0, max_samples - frame.spp)));
+			resolved[i] = (clamped * weight + frame.sums[i]) / (weight + frame.spp);
+			new_samples[i] = weight + frame.spp;
+			taken++;
+		}
+	}
+
+	reused = n > 0 ? float(taken) / n : 0;
+	double total = 0;
+	for (float s : new_samples) total += s;
+	mean_samples = n > 0 ? float(total / n) : 0;
+	width = w;
+	height = h;
+	previous.reset(new camera(cam));
+	means = resolved;
+	samples.swap(new_samples);
+	positions = frame.positions;
+	hits = frame.hits;
+}
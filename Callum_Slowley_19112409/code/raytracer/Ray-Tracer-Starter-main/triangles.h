@@ -7,25 +7,28 @@
 class triangle :public hittable {
 public:
 	triangle() {}
-	triangle(Point3f vert0, Point3f vert1, Point3f vert2, Vec3f vertNormal0, Vec3f vertNormal1, Vec3f vertNormal2, Vec2f UVx, Vec2f UVy, shared_ptr<material> m) :
-		v0(vert0), v1(vert1), v2(vert2),v0n(vertNormal0), v1n(vertNormal1),  v2n(vertNormal2), uvx(UVx),uvy(UVy),mat_ptr(m) {
+	triangle(Point3f vert0, Point3f vert1, Point3f vert2, Vec3f vertNormal0, Vec3f vertNormal1, Vec3f vertNormal2, Vec2f UVx, Vec2f UVy, int m) :
+		v0(vert0), v1(vert1), v2(vert2),v0n(vertNormal0), v1n(vertNormal1),  v2n(vertNormal2), uvx(UVx),uvy(UVy),mat_id(m) {
 		normal = (v1 - v0).crossProduct(v2 - v0);
 	};
 
-	triangle(Point3f vert0, Point3f vert1, Point3f vert2, Vec3f vn, shared_ptr<material> m) :v0(vert0), v1(vert1), v2(vert2), normal(vn), mat_ptr(m) {};
+	triangle(Point3f vert0, Point3f vert1, Point3f vert2, Vec3f vn, int m) :v0(vert0), v1(vert1), v2(vert2), normal(vn), mat_id(m) {};
 
 	virtual bool hit(const Ray& r, double t_min, double t_max, hit_record& rec) const override;
 
 	virtual bool bounding_box(aabb& output_box) const override;
+	virtual bool clipped_bounding_box(const aabb& clip, aabb& output_box) const override;
+	virtual void get_surface(const Ray& r, hit_record& rec) const override;
 
 public:
 	Point3f v0, v1, v2;
 	Vec3f normal,v0n,v1n,v2n;
 	Vec2f uvx, uvy;
-	shared_ptr<material> mat_ptr;
+	int mat_id;
 };
 
 bool triangle::hit(const Ray& r, double t_min, double t_max, hit_record& rec) const {
+	counters().triangle_tests++;
 	float thit, t, u, v;
 
 	Vec3<float> v0v1 = v1 - v0;
@@ -52,19 +55,28 @@ bool triangle::hit(const Ray& r, double t_min, double t_max, hit_record& rec) co
 
 	t = v0v2.dotProduct(gvec) * invDet;
 
-	if (t < 0) return false;
+	if (t < t_min || t > t_max) return false;
 
-	rec.p = r.at(t);
+	//only what is needed to pick the closest hit, the rest waits for get_surface
 	rec.t = t;
+	rec.bary_u = u;
+	rec.bary_v = v;
+	rec.prim = this;
+	rec.inst = nullptr;
+	rec.mat_id = mat_id;
+	
+	return true;
+}
+
+inline void triangle::get_surface(const Ray& r, hit_record& rec) const {
+	rec.p = r.at(rec.t);
 	//needed to load texture.
 	rec.u = uvx.x;
 	rec.v = uvy.y;
 	 //fix normal calacutaions
-	rec.normal = this->v1n * u + this->v2n * v + this->v0n * (1.0f - u - v);
-
-	rec.mat_ptr = mat_ptr;
-	
-	return true;
+	rec.normal = this->v1n * rec.bary_u + this->v2n * rec.bary_v + this->v0n * (1.0f - rec.bary_u - rec.bary_v);
+	//hit() rejects back facing triangles so anything that gets here is front facing
+	rec.front_face = true;
 }
 
 inline bool triangle::bounding_box(aabb& output_box)const {
@@ -74,6 +86,52 @@ inline bool triangle::bounding_box(aabb& output_box)const {
 		min[i] = std::min(v0[i], std::min(v1[i], v2[i]));
 		max[i] = std::max(v0[i], std::max(v1[i], v2[i]));
 	}
-	output_box = aabb(Vec3f(min[0], min[1], min[2]), Vec3f(max[0], max[1], max[2]));
+	output_box = padded(aabb(Vec3f(min[0], min[1], min[2]), Vec3f(max[0], max[1], max[2])));
+	return true;
+}
+
+inline bool triangle::clipped_bounding_box(const aabb& clip, aabb& output_box) const {
+	// Sutherland-Hodgman, clip the triangle against the six planes of the box one at a time.
+	// each plane can add at most one vertex so nine is enough
+	Point3f poly[9], clipped[9];
+	int count = 3;
+	poly[0] = v0; poly[1] = v1; poly[2] = v2;
+
+	for (int axis = 0; axis < 3; axis++) {
+		for (int side = 0; side < 2; side++) {
+			float plane = side == 0 ? clip.min()[axis] : clip.max()[axis];
+			int n = 0;
+			for (int i = 0; i < count; i++) {
+				const Point3f& a = poly[i];
+				const Point3f& b = poly[(i + 1) % count];
+				bool a_in = side == 0 ? a[axis] >= plane : a[axis] <= plane;
+				bool b_in = side == 0 ? b[axis] >= plane : b[axis] <= plane;
+				if (a_in) clipped[n++] = a;
+				if (a_in != b_in) {
+					float t = (plane - a[axis]) / (b[axis] - a[axis]);
+					Point3f p = a + (b - a) * t;
+					p[axis] = plane;
+					clipped[n++] = p;
+				}
+			}
+			count = n;
+			if (count == 0) return false;
+			for (int i = 0; i < count; i++) poly[i] = clipped[i];
+		}
+	}
+
+	Point3f small = poly[0], big = poly[0];
+	for (int i = 1; i < count; i++) {
+		for (int a = 0; a < 3; a++) {
+			small[a] = std::min(small[a], poly[i][a]);
+			big[a] = std::max(big[a], poly[i][a]);
+		}
+	}
+	// rounding in the intersection points can step just outside the clip box
+	for (int a = 0; a < 3; a++) {
+		small[a] = std::max(small[a], clip.min()[a]);
+		big[a] = std::min(big[a], clip.max()[a]);
+	}
+	output_box = padded(aabb(small, big));
 	return true;
 }
\ No newline at end of file
@@ -0,0 +1,336 @@
+#pragma once
+#include "common.h"
+#include "Camera.h"
+#include "scene.h"
+#include "Multithreading.h"
+#include "ray_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// wall time of each stage over the last render, in milliseconds
+struct wavefront_timings {
+	double generate = 0;
+	double sort = 0;
+	double extend = 0;
+	double shade = 0;
+	double accumulate = 0;
+	int bounces = 0; // extend and shade rounds over all batches
+	size_t rays = 0; // rays intersected over all batches
+};
+
+// renders breadth first instead of one recursive ray_colour path at a time.
+// a batch of camera paths is generated, then every live path is intersected, then the hits are shaded
+// grouped by material so each scatter routine runs over a long run of paths, repeating until no path
+// is left. path state is kept in one array per field so each stage only streams through what it uses.
+// paths end exactly as in ray_colour: background on a miss, emitted when nothing scatters, black at
+// max depth. there is no light sampling here so there is no shadow ray stage
+class wavefront_renderer {
+public:
+	wavefront_renderer(int w, int h, int samples, int depth, size_t batch = size_t(1) << 18)
+		: width(w), height(h), spp(samples), max_depth(depth), batch_size(batch) {}
+
+	// framebuffer gets width*height colours, each the sum over spp samples
+	void render(const scene& world, const camera& cam, std::vector<Colour>& framebuffer);
+
+public:
+	int width, height, spp, max_depth;
+	size_t batch_size;
+	int threads = std::thread::hardware_concurrency();
+	// batches are filled a tile of pixels at a time. sort_secondary also sorts the bounced rays of a
+	// batch by direction octant then by where they start, so neighbouring rays walk the same bvh nodes.
+	// it pays off once the bvh no longer fits in cache, the test scene is small enough that it does not
+	bool sort_secondary = false;
+	int tile_size = 16;
+	// intersect each thread's share of the paths as one ray_stream instead of one hit() per path.
+	// with the cached reciprocal in Ray the single ray walk is the faster one on the test scene
+	bool stream_extend = false;
+	// every chunk of work seeds the random numbers from this and how many chunks came before it in the
+	// render, so a render can be repeated. change it between renders that should not share their samples
+	uint64_t seed = 1;
+	wavefront_timings timings;
+
+private:
+	void generate(const camera& cam, size_t first, size_t count);
+	void sort_rays(const aabb& bounds);
+	void extend(const scene& world);
+	void shade(const scene& world);
+	void accumulate(std::vector<Colour>& framebuffer);
+
+	// runs f(begin, end) over [0, n) split between the threads, returns once all are done
+	template<typename F>
+	void parallel_for(size_t n, F f);
+
+	// made by the first stage that needs it and kept for every later stage and render, remade if threads changes
+	std::unique_ptr<ThreadPool> pool;
+	int pool_threads = 0;
+
+	// path state, one entry per path of the current batch
+	std::vector<Point3f> origin;
+	std::vector<Vec3f> direction;
+	std::vector<Colour> throughput;
+	std::vector<Colour> background; // picked from the camera ray and kept for every bounce, like lineRender
+	std::vector<Colour> result;
+	std::vector<int> pixel;
+	std::vector<int> depth;
+	std::vector<hit_record> hits;
+	std::vector<uint8_t> hit_found;
+
+	// queues of path indices
+	std::vector<uint32_t> active;  // waiting to be intersected
+	std::vector<uint32_t> shading; // hit something, sorted by material before shading
+	std::vector<uint32_t> next;    // scattered, traced again next round
+
+	std::vector<int> pixel_order; // pixels tile by tile
+	std::vector<std::pair<uint64_t, uint32_t>> keys;
+
+	std::vector<uint32_t> bucket_start;
+	std::vector<int> material_order; // material ids grouped by type
+	uint64_t chunks = 0;
+};
+
+template<typename F>
+void wavefront_renderer::parallel_for(size_t n, F f) {
+	size_t workers = std::max(1, threads);
+	//a few chunks per thread so one slow chunk does not hold the stage up
+	size_t chunk = std::max<size_t>(256, n / (workers * 4) + 1);
+	if (workers == 1 || n <= chunk) {
+		seed_random((seed << 32) ^ chunks++);
+		f(size_t(0), n);
+		return;
+	}
+	if (!pool || pool_threads != int(workers)) {
+		pool.reset(new ThreadPool(static_cast<short>(workers)));
+		pool_threads = int(workers);
+	}
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t chunks_left = (n + chunk - 1) / chunk;
+	for (size_t begin = 0; begin < n; begin += chunk) {
+		size_t end = std::min(n, begin + chunk);
+		uint64_t chunk_seed = (seed << 32) ^ chunks++;
+		pool->Enqueue([&, begin, end, chunk_seed] {
+			seed_random(chunk_seed);
+			f(begin, end);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--chunks_left == 0) finished.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&chunks_left] { return chunks_left == 0; });
+}
+
+void wavefront_renderer::render(const scene& world, const camera& cam, std::vector<Colour>& framebuffer) {
+	typedef std::chrono::high_resolution_clock clock;
+	timings = wavefront_timings();
+	chunks = 0;
+	framebuffer.assign(size_t(width) * height, Colour(0, 0, 0));
+
+	material_order.resize(world.materials.size());
+	for (size_t i = 0; i < material_order.size(); i++) material_order[i] = static_cast<int>(i);
+	std::stable_sort(material_order.begin(), material_order.end(), [&world](int a, int b) {
+		return world.materials.type(a) < world.materials.type(b);
+	});
+
+	pixel_order.clear();
+	int step = std::max(1, tile_size);
+	for (int ty = 0; ty < height; ty += step)
+		for (int tx = 0; tx < width; tx += step)
+			for (int y = ty; y < std::min(height, ty + step); y++)
+				for (int x = tx; x < std::min(width, tx + step); x++)
+					pixel_order.push_back(y * width + x);
+
+	aabb bounds;
+	bool sortable = sort_secondary && world.bounding_box(bounds);
+
+	size_t total = size_t(width) * height * spp;
+	for (size_t first = 0; first < total; first += batch_size) {
+		size_t count = std::min(batch_size, total - first);
+
+		auto t0 = clock::now();
+		generate(cam, first, count);
+		auto t1 = clock::now();
+		timings.generate += std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+		for (int bounce = 0; !active.empty(); bounce++) {
+			//camera rays are already coherent, only the bounced ones need sorting
+			if (sortable && bounce > 0) {
+				t0 = clock::now();
+				sort_rays(bounds);
+				timings.sort += std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+			}
+			t0 = clock::now();
+			extend(world);
+			t1 = clock::now();
+			shade(world);
+			auto t2 = clock::now();
+			timings.extend += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			timings.shade += std::chrono::duration<double, std::milli>(t2 - t1).count();
+			timings.bounces++;
+		}
+
+		t0 = clock::now();
+		accumulate(framebuffer);
+		t1 = clock::now();
+		timings.accumulate += std::chrono::duration<double, std::milli>(t1 - t0).count();
+	}
+}
+
+void wavefront_renderer::generate(const camera& cam, size_t first, size_t count) {
+	origin.resize(count);
+	direction.resize(count);
+	throughput.resize(count);
+	background.resize(count);
+	result.resize(count);
+	pixel.resize(count);
+	depth.resize(count);
+	hits.resize(count);
+	hit_found.resize(count);
+
+	//samples of a pixel are neighbours in the batch, path first + i is sample (first + i) % spp
+	parallel_for(count, [&](size_t begin, size_t end) {
+		counters().primary_rays += end - begin;
+		for (size_t i = begin; i < end; i++) {
+			int p = pixel_order[(first + i) / spp];
+			int x = p % width, y = p / width;
+			auto u = double(x + random_double()) / (width - 1);
+			auto v = double(y + random_double()) / (height - 1);
+			Ray ray = cam.get_ray(u, v);
+			Vec3f unit_direction = ray.unit_direction();
+			auto t = 0.5 * (unit_direction.y + 1.0);
+
+			origin[i] = ray.origin();
+			direction[i] = ray.direction();
+			throughput[i] = Colour(1, 1, 1);
+			background[i] = (1.0 - t) * Colour(1.0, 1.0, 1.0) + t * Colour(0.5, 0.7, 1.0) * 255;
+			result[i] = Colour(0, 0, 0);
+			pixel[i] = p;
+			depth[i] = max_depth;
+		}
+	});
+
+	active.resize(count);
+	for (size_t i = 0; i < count; i++) active[i] = static_cast<uint32_t>(i);
+}
+
+// spreads the low 10 bits of v out to every third bit
+inline uint32_t morton_spread(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+void wavefront_renderer::sort_rays(const aabb& bounds) {
+	keys.resize(active.size());
+	Vec3f extent = bounds.max() - bounds.min();
+	parallel_for(active.size(), [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			uint32_t i = active[k];
+			//octant in the top bits so rays heading the same way stay together, then a morton code of the origin
+			uint64_t octant = (direction[i].x < 0 ? 1 : 0) | (direction[i].y < 0 ? 2 : 0) | (direction[i].z < 0 ? 4 : 0);
+			uint32_t cell[3];
+			for (int a = 0; a < 3; a++) {
+				double f = extent[a] > 0 ? (origin[i][a] - bounds.min()[a]) / extent[a] : 0;
+				cell[a] = static_cast<uint32_t>(clamp(f, 0, 1) * 1023);
+			}
+			uint64_t code = morton_spread(cell[0]) | (morton_spread(cell[1]) << 1) | (morton_spread(cell[2]) << 2);
+			keys[k] = std::make_pair(octant << 30 | code, i);
+		}
+	});
+	std::sort(keys.begin(), keys.end());
+	for (size_t k = 0; k < keys.size(); k++) active[k] = keys[k].second;
+}
+
+void wavefront_renderer::extend(const scene& world) {
+	timings.rays += active.size();
+	parallel_for(active.size(), [&](size_t begin, size_t end) {
+		ray_stream rays;
+		std::vector<uint32_t> traced;
+		if (stream_extend) rays.reserve(end - begin);
+		render_counters& stats = counters();
+		for (size_t k = begin; k < end; k++) {
+			uint32_t i = active[k];
+			//out of bounces, no more light gathered
+			if (depth[i] <= 0) {
+				hit_found[i] = 0;
+				continue;
+			}
+			if (depth[i] < max_depth) stats.secondary_rays++;
+			if (stream_extend) {
+				rays.add(Ray(origin[i], direction[i]), 0.001, infinity);
+				traced.push_back(i);
+			}
+			else {
+				hit_found[i] = world.hit(Ray(origin[i], direction[i]), 0.001, infinity, hits[i]) ? 1 : 2;
+			}
+		}
+		if (traced.empty()) return;
+
+		hit_stream found;
+		intersect(world, rays, found);
+		for (size_t j = 0; j < traced.size(); j++) {
+			uint32_t i = traced[j];
+			hit_found[i] = found.found[j] ? 1 : 2;
+			if (found.found[j]) hits[i] = found.records[j];
+		}
+	});
+
+	shading.clear();
+	for (uint32_t i : active) {
+		if (hit_found[i] == 1) shading.push_back(i);
+		else if (hit_found[i] == 2) result[i] = throughput[i] * background[i];
+	}
+}
+
+void wavefront_renderer::shade(const scene& world) {
+	//counting sort of the hits by material, buckets laid out in material_order so a type stays together
+	size_t materials = world.materials.size();
+	bucket_start.assign(materials + 1, 0);
+	for (uint32_t i : shading) bucket_start[hits[i].mat_id + 1]++;
+	std::vector<uint32_t> offset(materials, 0);
+	uint32_t running = 0;
+	for (int id : material_order) {
+		offset[id] = running;
+		running += bucket_start[id + 1];
+	}
+	active.resize(shading.size());
+	for (uint32_t i : shading) active[offset[hits[i].mat_id]++] = i;
+
+	next.resize(active.size());
+	parallel_for(active.size(), [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			uint32_t i = active[k];
+			hit_record& rec = hits[i];
+			Ray ray(origin[i], direction[i]);
+			rec.finalize(ray);
+
+			Ray scattered;
+			Colour attenuation;
+			if (!world.materials.scatter(rec.mat_id, ray, rec, attenuation, scattered)) {
+				result[i] = throughput[i] * world.materials.emitted(rec.mat_id);
+				next[k] = UINT32_MAX;
+				continue;
+			}
+			throughput[i] = throughput[i] * attenuation;
+			origin[i] = scattered.origin();
+			direction[i] = scattered.direction();
+			depth[i]--;
+			next[k] = i;
+		}
+	});
+
+	//paths that scattered go round again, the rest already have their result
+	next.erase(std::remove(next.begin(), next.end(), UINT32_MAX), next.end());
+	active.swap(next);
+}
+
+void wavefront_renderer::accumulate(std::vector<Colour>& framebuffer) {
+	for (size_t i = 0; i < pixel.size(); i++) framebuffer[pixel[i]] = framebuffer[pixel[i]] + result[i];
+}